@@ -0,0 +1,865 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright 2016-2017 Davide Faconti
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+* *******************************************************************/
+
+#ifndef ROS_INTROSPECTION_DESERIALIZE_PLAN_H
+#define ROS_INTROSPECTION_DESERIALIZE_PLAN_H
+
+// Included by ros_introspection.hpp: do not include directly.
+
+#include <limits>
+#include <cstring>
+
+namespace RosIntrospection{
+
+namespace details{
+
+inline ParseStatus ParseError(ParseStatus::Code code, uint64_t offset, const StringTreeNode* node)
+{
+  ParseStatus status;
+  status.code = code;
+  status.offset = static_cast<uint32_t>(offset);
+  status.node = node;
+  return status;
+}
+
+// Visit the length prefixes of the buffer, without decoding the values, to verify that
+// the buffer is well formed and has exactly the expected size.
+inline ParseStatus ValidateBuffer(const std::vector<PlanInstruction>& plan,
+                                  Span<uint8_t> buffer)
+{
+  const uint64_t buffer_size = buffer.size();
+  uint64_t offset = 0;
+  ParseStatus status;
+
+  struct Loop{
+    uint32_t body;
+    uint32_t remaining;
+  };
+  boost::container::small_vector<Loop, 16> loops;
+
+  // These return false, after setting status, if the buffer is malformed.
+  auto readPrefix = [&]( const PlanInstruction& instr, uint32_t& value ) -> bool
+  {
+    if( offset + sizeof(uint32_t) > buffer_size )
+    {
+      status = ParseError( ParseStatus::PREFIX_OVERRUN, offset, instr.node );
+      return false;
+    }
+    std::memcpy( &value, buffer.data() + offset, sizeof(uint32_t) );
+    offset += sizeof(uint32_t);
+    return true;
+  };
+
+  auto skip = [&]( const PlanInstruction& instr, uint64_t bytes ) -> bool
+  {
+    offset += bytes;
+    if( offset > buffer_size )
+    {
+      status = ParseError( ParseStatus::BUFFER_OVERRUN, offset - bytes, instr.node );
+      return false;
+    }
+    return true;
+  };
+
+  // The length of an array is signed, as in DeserializeWithPlan: a negative one is an empty array.
+  auto readLength = [&]( const PlanInstruction& instr, uint32_t& value ) -> bool
+  {
+    if( !readPrefix( instr, value ) )
+    {
+      return false;
+    }
+    if( static_cast<int32_t>(value) < 0 )
+    {
+      value = 0;
+    }
+    return true;
+  };
+
+  auto arraySize = [&]( const PlanInstruction& instr, uint32_t& value ) -> bool
+  {
+    if( instr.array_size == -1 )
+    {
+      return readLength( instr, value );
+    }
+    value = static_cast<uint32_t>(instr.array_size);
+    return true;
+  };
+
+  size_t pc = 0;
+  while( pc < plan.size() )
+  {
+    const PlanInstruction& instr = plan[pc];
+
+    switch( instr.op )
+    {
+    case PlanInstruction::READ_BUILTIN:
+    {
+      if( !skip( instr, builtinSize(instr.type) ) ) return status;
+      pc++;
+    } break;
+
+    case PlanInstruction::READ_STRING:
+    case PlanInstruction::READ_ARRAY:
+    case PlanInstruction::SKIP_STRING:
+    {
+      uint32_t count = 1;
+      if( instr.op == PlanInstruction::READ_ARRAY ||
+          (instr.op == PlanInstruction::SKIP_STRING && instr.array_size != 1) )
+      {
+        if( !arraySize( instr, count ) ) return status;
+      }
+      if( instr.type == STRING )
+      {
+        for (uint32_t i=0; i<count; i++)
+        {
+          uint32_t string_size = 0;
+          if( !readPrefix( instr, string_size ) || !skip( instr, string_size ) ) return status;
+        }
+      }
+      else if( !skip( instr, static_cast<uint64_t>(count) * builtinSize(instr.type) ) )
+      {
+        return status;
+      }
+      pc++;
+    } break;
+
+    case PlanInstruction::SKIP_BYTES:
+    {
+      if( !skip( instr, instr.size ) ) return status;
+      pc++;
+    } break;
+
+    case PlanInstruction::SKIP_ARRAY:
+    {
+      uint32_t count = 0;
+      if( !readLength( instr, count ) ||
+          !skip( instr, static_cast<uint64_t>(count) * instr.size ) ) return status;
+      pc++;
+    } break;
+
+    case PlanInstruction::BEGIN_LOOP:
+    {
+      uint32_t count = 0;
+      if( !arraySize( instr, count ) ) return status;
+      if( count == 0 || instr.size > 0 )
+      {
+        if( !skip( instr, static_cast<uint64_t>(count) * instr.size ) ) return status;
+        pc = instr.jump;
+      }
+      else{
+        loops.push_back( { static_cast<uint32_t>(pc+1), count } );
+        pc++;
+      }
+    } break;
+
+    case PlanInstruction::END_LOOP:
+    {
+      Loop& loop = loops.back();
+      if( --loop.remaining > 0 )
+      {
+        pc = loop.body;
+      }
+      else{
+        loops.pop_back();
+        pc++;
+      }
+    } break;
+
+    case PlanInstruction::DESCEND:
+    {
+      if( instr.size > 0 )
+      {
+        if( !skip( instr, instr.size ) ) return status;
+        pc = instr.jump;
+      }
+      else{
+        pc++;
+      }
+    } break;
+
+    case PlanInstruction::ASCEND:
+    {
+      pc++;
+    } break;
+    }
+  }
+
+  if( offset < buffer_size )
+  {
+    return ParseError( ParseStatus::SIZE_MISMATCH, offset, nullptr );
+  }
+  return status;
+}
+
+
+// Execute the plan compiled by Parser::compilePlan, passing the decoded values to a Writer
+// (see FlatMessageWriter in ros_introspection.cpp or HandlerWriter). The Writer provides:
+//
+//  - shapeCache(): the ShapeCache where the shape of the message is recorded, together
+//    with blobPolicy() and stringPolicy(). nullptr if the Writer doesn't use it.
+//  - truncatesArrays(): if true, only the first max_array_size elements of an array are
+//    stored. In both cases, arrays of elements of size 1 larger than that are blobs.
+//  - reset() and finish(), called before the first value and after the last one.
+//  - reserveValues(count), called before [count] calls to storeFixedLeaf.
+//  - storeValue, storeFixedLeaf, storeArray<ELEM_SIZE>, storeString and storeBlob.
+//    The data they receive points to the buffer.
+//
+// If CHECKED is false, the buffer is validated first and the bounds of each
+// read are not checked anymore. Errors are reported by the returned ParseStatus,
+// that is the same for both values of CHECKED.
+template <bool CHECKED, class Writer>
+ParseStatus DeserializeWithPlan(const ROSMessageInfo& msg_info,
+                                Span<uint8_t> buffer,
+                                const uint32_t max_array_size,
+                                const bool discard_large_array,
+                                Writer& writer)
+{
+  ShapeCache* shape = writer.shapeCache();
+  ParseStatus status;
+
+  // record a new shape
+  if( shape )
+  {
+    shape->info = nullptr;
+    shape->prefixes.clear();
+    shape->values.clear();
+    shape->value_count = 0;
+    shape->strings.clear();
+    shape->blobs.clear();
+  }
+  writer.reset();
+
+  // maximum number of elements of an array passed to the writer
+  const uint32_t store_limit = writer.truncatesArrays() ?
+        max_array_size : std::numeric_limits<uint32_t>::max();
+
+  // consecutive values of the same type are merged into a single run
+  auto recordValues = [&]( size_t offset, BuiltinType type, size_t count )
+  {
+    if( !shape )
+    {
+      return;
+    }
+    if( !shape->values.empty() )
+    {
+      ShapeCache::ValueRun& last = shape->values.back();
+      if( last.type == type && last.offset + last.count * builtinSize(type) == offset )
+      {
+        last.count += count;
+        shape->value_count += count;
+        return;
+      }
+    }
+    ShapeCache::ValueRun run;
+    run.offset = offset;
+    run.count  = count;
+    run.type   = type;
+    shape->values.push_back( run );
+    shape->value_count += count;
+  };
+
+  auto recordShape = [&]( bool entire_message_parse )
+  {
+    if( !shape )
+    {
+      return;
+    }
+    shape->info = &msg_info;
+    shape->plan_version = msg_info.plan_version;
+    shape->max_array_size = max_array_size;
+    shape->discard_large_array = discard_large_array;
+    shape->blob_policy = writer.blobPolicy();
+    shape->string_policy = writer.stringPolicy();
+    shape->buffer_size = buffer.size();
+    shape->entire_message_parse = entire_message_parse;
+  };
+
+  // Fast path: every leaf is at a known offset and no array is affected by max_array_size.
+  if( msg_info.fixed_size >= 0 &&
+      max_array_size > 0 && msg_info.fixed_max_array_size <= max_array_size )
+  {
+    if( buffer.size() != static_cast<size_t>(msg_info.fixed_size) )
+    {
+      return ParseError( ParseStatus::SIZE_MISMATCH, msg_info.fixed_size, nullptr );
+    }
+    const std::vector<FixedLeaf>& layout = msg_info.has_projection ?
+          msg_info.projected_layout : msg_info.fixed_layout;
+    const uint8_t* data = buffer.data();
+
+    writer.reserveValues( layout.size() );
+    for (const FixedLeaf& leaf: layout)
+    {
+      writer.storeFixedLeaf( leaf, data );
+      recordValues( leaf.offset, leaf.type, 1 );
+    }
+    writer.finish();
+    recordShape( true );
+    return status;
+  }
+
+  const std::vector<PlanInstruction>& plan = msg_info.has_projection ?
+        msg_info.projected_plan : msg_info.plan;
+
+  if( !CHECKED )
+  {
+    // ValidateBuffer skips nested messages with a fixed size at once. On failure,
+    // the checked decoding finds the field that exceeds the buffer.
+    if( !ValidateBuffer( plan, buffer ).ok() )
+    {
+      return DeserializeWithPlan<true>( msg_info, buffer, max_array_size, discard_large_array, writer );
+    }
+  }
+
+  bool entire_message_parse = true;
+  size_t buffer_offset = 0;
+
+  // One frame is pushed by each BEGIN_LOOP and DESCEND.
+  // DO_STORE follows the same scoping that the recursive implementation had:
+  // a large array discards the following fields of the same message only.
+  struct Frame{
+    uint32_t body;
+    int32_t  index;
+    int32_t  size;
+    bool     parent_store;
+    bool     array_store;
+  };
+  boost::container::small_vector<Frame, 16> stack;
+
+  StringTreeLeaf tree_leaf;
+  bool DO_STORE = true;
+
+  // A field that is not an array is handled as an array with a single element: with
+  // max_array_size == 0 it is a large array, that is stored only if it is a blob.
+  auto storeSingle = [&]( BuiltinType type ) -> bool
+  {
+    if( store_limit > 0 )
+    {
+      return DO_STORE;
+    }
+    if( builtinSize(type) != 1 )
+    {
+      if( discard_large_array ){
+        DO_STORE = false;
+      }
+      entire_message_parse = false;
+    }
+    return false;
+  };
+
+  // The following lambdas return false, after setting status, if the buffer is too short.
+  // This never happens if CHECKED is false.
+  auto overrun = [&]( ParseStatus::Code code, const PlanInstruction& instr ) -> bool
+  {
+    status = ParseError( code, buffer_offset, instr.node );
+    return false;
+  };
+
+  auto readPrefix = [&]( const PlanInstruction& instr, uint32_t& value ) -> bool
+  {
+    if( CHECKED && buffer_offset + sizeof(uint32_t) > buffer.size() )
+    {
+      return overrun( ParseStatus::PREFIX_OVERRUN, instr );
+    }
+    std::memcpy( &value, &buffer[buffer_offset], sizeof(uint32_t) );
+    if( shape )
+    {
+      shape->prefixes.push_back( std::make_pair( static_cast<uint32_t>(buffer_offset), value ) );
+    }
+    buffer_offset += sizeof(uint32_t);
+    return true;
+  };
+
+  auto readString = [&]( const PlanInstruction& instr, bool store ) -> bool
+  {
+    uint32_t string_size = 0;
+    if( !readPrefix( instr, string_size ) )
+    {
+      return false;
+    }
+    if( CHECKED && buffer_offset + string_size > buffer.size())
+    {
+      return overrun( ParseStatus::BUFFER_OVERRUN, instr );
+    }
+    if( store )
+    {
+      writer.storeString( tree_leaf, reinterpret_cast<const char*>( &buffer[buffer_offset] ), string_size );
+      if( shape )
+      {
+        shape->strings.push_back( std::make_pair( static_cast<uint32_t>(buffer_offset), string_size ) );
+      }
+    }
+    buffer_offset += string_size;
+    return true;
+  };
+
+  // Reads the size of the array and applies the max_array_size policy.
+  auto readArraySize = [&]( const PlanInstruction& instr, bool* is_blob, int32_t& array_size ) -> bool
+  {
+    array_size = instr.array_size;
+    if( array_size == -1)
+    {
+      uint32_t value = 0;
+      if( !readPrefix( instr, value ) )
+      {
+        return false;
+      }
+      array_size = static_cast<int32_t>(value);
+    }
+    *is_blob = false;
+    // Stop storing it if is NOT a blob and a very large array.
+    if( array_size > static_cast<int32_t>(max_array_size))
+    {
+      if( builtinSize(instr.type) == 1){
+        *is_blob = true;
+      }
+      else{
+        if( discard_large_array ){
+          DO_STORE = false;
+        }
+        entire_message_parse = false;
+      }
+    }
+    return true;
+  };
+
+  // Called at the beginning of each iteration of a BEGIN_LOOP
+  auto beginIteration = [&]( Frame& frame )
+  {
+    if( frame.array_store && static_cast<uint32_t>(frame.index) >= store_limit )
+    {
+      frame.array_store = false;
+    }
+    if( frame.array_store )
+    {
+      tree_leaf.index_array.back() = frame.index;
+    }
+    DO_STORE = frame.array_store;
+  };
+
+  const size_t plan_size = plan.size();
+  size_t pc = 0;
+
+  while( pc < plan_size )
+  {
+    const PlanInstruction& instr = plan[pc];
+
+    switch( instr.op )
+    {
+    case PlanInstruction::READ_BUILTIN:
+    {
+      const size_t size = builtinSize(instr.type);
+      if( CHECKED && buffer_offset + size > buffer.size() )
+      {
+        overrun( ParseStatus::BUFFER_OVERRUN, instr );
+        return status;
+      }
+      if( storeSingle( instr.type ) )
+      {
+        tree_leaf.node_ptr = instr.node;
+        writer.storeValue( tree_leaf, instr.type, &buffer[buffer_offset], size );
+        recordValues( buffer_offset, instr.type, 1 );
+      }
+      else if( DO_STORE && size == 1 && store_limit == 0 )
+      {
+        // a single byte larger than max_array_size is a blob
+        tree_leaf.node_ptr = instr.node;
+        writer.storeBlob( tree_leaf, &buffer[buffer_offset], size );
+        if( shape )
+        {
+          shape->blobs.push_back( std::make_pair( static_cast<uint32_t>(buffer_offset), 1u ) );
+        }
+      }
+      buffer_offset += size;
+      pc++;
+    } break;
+
+    case PlanInstruction::READ_STRING:
+    {
+      tree_leaf.node_ptr = instr.node;
+      if( !readString( instr, storeSingle( STRING ) ) )
+      {
+        return status;
+      }
+      pc++;
+    } break;
+
+    case PlanInstruction::READ_ARRAY:
+    {
+      bool IS_BLOB = false;
+      int32_t array_size = 0;
+      if( !readArraySize( instr, &IS_BLOB, array_size ) )
+      {
+        return status;
+      }
+      tree_leaf.node_ptr = instr.node;
+      tree_leaf.index_array.push_back(0);
+
+      if( IS_BLOB ) // special case. This is a "blob", typically an image, a map, pointcloud, etc.
+      {
+        if( CHECKED && buffer_offset + array_size > buffer.size() )
+        {
+          overrun( ParseStatus::BUFFER_OVERRUN, instr );
+          return status;
+        }
+        if( DO_STORE )
+        {
+          writer.storeBlob( tree_leaf, &buffer[buffer_offset], array_size );
+          if( shape )
+          {
+            shape->blobs.push_back( std::make_pair( static_cast<uint32_t>(buffer_offset),
+                                                    static_cast<uint32_t>(array_size) ) );
+          }
+        }
+        buffer_offset += array_size;
+      }
+      else if( instr.type == STRING )
+      {
+        bool DO_STORE_ARRAY = DO_STORE;
+        for (int i=0; i<array_size; i++ )
+        {
+          if( DO_STORE_ARRAY && static_cast<uint32_t>(i) >= store_limit )
+          {
+            DO_STORE_ARRAY = false;
+          }
+          if( DO_STORE_ARRAY )
+          {
+            tree_leaf.index_array.back() = i;
+          }
+          if( !readString( instr, DO_STORE_ARRAY ) )
+          {
+            return status;
+          }
+        }
+      }
+      else if( array_size > 0 )
+      {
+        // numerical arrays are decoded in a single block
+        const size_t elem_size = builtinSize(instr.type);
+        const size_t array_bytes = elem_size * array_size;
+
+        if( CHECKED && buffer_offset + array_bytes > buffer.size() )
+        {
+          overrun( ParseStatus::BUFFER_OVERRUN, instr );
+          return status;
+        }
+
+        const size_t store_count = !DO_STORE ? 0 :
+              std::min( static_cast<size_t>(array_size), static_cast<size_t>(store_limit) );
+
+        if( store_count > 0 )
+        {
+          const uint8_t* src = &buffer[buffer_offset];
+          switch( elem_size )
+          {
+          case 1: writer.template storeArray<1>( tree_leaf, instr.type, src, store_count ); break;
+          case 2: writer.template storeArray<2>( tree_leaf, instr.type, src, store_count ); break;
+          case 4: writer.template storeArray<4>( tree_leaf, instr.type, src, store_count ); break;
+          case 8: writer.template storeArray<8>( tree_leaf, instr.type, src, store_count ); break;
+          }
+          recordValues( buffer_offset, instr.type, store_count );
+        }
+        buffer_offset += array_bytes;
+      }
+      tree_leaf.index_array.pop_back();
+      pc++;
+    } break;
+
+    case PlanInstruction::BEGIN_LOOP:
+    {
+      bool IS_BLOB = false;
+      int32_t array_size = 0;
+      if( !readArraySize( instr, &IS_BLOB, array_size ) )
+      {
+        return status;
+      }
+      if( array_size <= 0 )
+      {
+        pc = instr.jump;
+        break;
+      }
+      Frame frame;
+      frame.body         = pc + 1;
+      frame.index        = 0;
+      frame.size         = array_size;
+      frame.parent_store = DO_STORE;
+      frame.array_store  = DO_STORE;
+      stack.push_back( frame );
+      tree_leaf.index_array.push_back(0);
+      beginIteration( stack.back() );
+      pc++;
+    } break;
+
+    case PlanInstruction::END_LOOP:
+    {
+      Frame& frame = stack.back();
+      if( ++frame.index < frame.size )
+      {
+        beginIteration( frame );
+        pc = frame.body;
+      }
+      else{
+        DO_STORE = frame.parent_store;
+        tree_leaf.index_array.pop_back();
+        stack.pop_back();
+        pc++;
+      }
+    } break;
+
+    case PlanInstruction::DESCEND:
+    {
+      const bool store = storeSingle( OTHER );
+      Frame frame;
+      frame.parent_store = DO_STORE;
+      stack.push_back( frame );
+      DO_STORE = store;
+      pc++;
+    } break;
+
+    case PlanInstruction::ASCEND:
+    {
+      DO_STORE = stack.back().parent_store;
+      stack.pop_back();
+      pc++;
+    } break;
+
+    case PlanInstruction::SKIP_BYTES:
+    {
+      // same effect that these fields would have on DO_STORE if they were parsed
+      if( instr.array_size > static_cast<int32_t>(max_array_size) )
+      {
+        if( discard_large_array ){
+          DO_STORE = false;
+        }
+        entire_message_parse = false;
+      }
+      if( instr.nested_array_size > max_array_size )
+      {
+        entire_message_parse = false;
+      }
+      if( CHECKED && buffer_offset + instr.size > buffer.size() )
+      {
+        overrun( ParseStatus::BUFFER_OVERRUN, instr );
+        return status;
+      }
+      buffer_offset += instr.size;
+      pc++;
+    } break;
+
+    case PlanInstruction::SKIP_ARRAY:
+    {
+      bool IS_BLOB = false;
+      int32_t array_size = 0;
+      if( !readArraySize( instr, &IS_BLOB, array_size ) )
+      {
+        return status;
+      }
+      // as in READ_ARRAY, a negative length is an empty array
+      if( array_size > 0 )
+      {
+        if( instr.nested_array_size > max_array_size )
+        {
+          entire_message_parse = false;
+        }
+        const size_t array_bytes = static_cast<size_t>(instr.size) * static_cast<size_t>(array_size);
+        if( CHECKED && buffer_offset + array_bytes > buffer.size() )
+        {
+          overrun( ParseStatus::BUFFER_OVERRUN, instr );
+          return status;
+        }
+        buffer_offset += array_bytes;
+      }
+      pc++;
+    } break;
+
+    case PlanInstruction::SKIP_STRING:
+    {
+      int32_t array_size = 1;
+      if( instr.array_size != 1 )
+      {
+        bool IS_BLOB = false;
+        if( !readArraySize( instr, &IS_BLOB, array_size ) )
+        {
+          return status;
+        }
+      }
+      for (int i=0; i<array_size; i++ )
+      {
+        if( !readString( instr, false ) )
+        {
+          return status;
+        }
+      }
+      pc++;
+    } break;
+    }
+  }
+
+  writer.finish();
+
+  if( buffer_offset != buffer.size() )
+  {
+    return ParseError( ParseStatus::SIZE_MISMATCH, buffer_offset, nullptr );
+  }
+  recordShape( entire_message_parse );
+  status.entire_message_parse = entire_message_parse;
+  return status;
+}
+// Decode the buffer with the given ValidationPolicy.
+template <class Writer>
+ParseStatus Deserialize(const ROSMessageInfo& msg_info,
+                        Span<uint8_t> buffer,
+                        const uint32_t max_array_size,
+                        const bool discard_large_array,
+                        Parser::ValidationPolicy validation_policy,
+                        Writer& writer)
+{
+  if( validation_policy == Parser::VALIDATE_BEFORE_PARSING )
+  {
+    return DeserializeWithPlan<false>( msg_info, buffer, max_array_size, discard_large_array, writer );
+  }
+  return DeserializeWithPlan<true>( msg_info, buffer, max_array_size, discard_large_array, writer );
+}
+
+/// Throws the exception that deserializeIntoFlatContainer uses for the error in [status].
+void ThrowParseError(const ParseStatus& status, const std::string& msg_identifier,
+                     size_t buffer_size, Parser::ValidationPolicy policy);
+
+template <typename T, class Handler> inline
+void CallOnValue(Handler& handler, const StringTreeLeaf& leaf, const uint8_t* data)
+{
+  T value;
+  std::memcpy( &value, data, sizeof(T) );
+  handler.onValue( leaf, value );
+}
+
+template <class Handler> inline
+void CallOnValue(Handler& handler, BuiltinType type, const StringTreeLeaf& leaf, const uint8_t* data)
+{
+  switch( type )
+  {
+  case BOOL: handler.onValue( leaf, static_cast<bool>( *data ) ); break;
+  case BYTE:
+  case UINT8:  CallOnValue<uint8_t> ( handler, leaf, data ); break;
+  case UINT16: CallOnValue<uint16_t>( handler, leaf, data ); break;
+  case UINT32: CallOnValue<uint32_t>( handler, leaf, data ); break;
+  case UINT64: CallOnValue<uint64_t>( handler, leaf, data ); break;
+  case CHAR:
+  case INT8:  CallOnValue<int8_t> ( handler, leaf, data ); break;
+  case INT16: CallOnValue<int16_t>( handler, leaf, data ); break;
+  case INT32: CallOnValue<int32_t>( handler, leaf, data ); break;
+  case INT64: CallOnValue<int64_t>( handler, leaf, data ); break;
+  case FLOAT32: CallOnValue<float> ( handler, leaf, data ); break;
+  case FLOAT64: CallOnValue<double>( handler, leaf, data ); break;
+  case TIME: {
+    ros::Time value;
+    std::memcpy( &value.sec,  data,     sizeof(uint32_t) );
+    std::memcpy( &value.nsec, data + 4, sizeof(uint32_t) );
+    handler.onValue( leaf, value );
+  } break;
+  case DURATION: {
+    ros::Duration value;
+    std::memcpy( &value.sec,  data,     sizeof(int32_t) );
+    std::memcpy( &value.nsec, data + 4, sizeof(int32_t) );
+    handler.onValue( leaf, value );
+  } break;
+  default: break;
+  }
+}
+
+// Writer of DeserializeWithPlan used by Parser::deserialize: each value is passed
+// to the Handler. Nothing is stored, therefore the shape is not cached.
+template <class Handler>
+class HandlerWriter
+{
+public:
+  explicit HandlerWriter(Handler& handler): _handler(handler) {}
+
+  ShapeCache* shapeCache() { return nullptr; }
+
+  bool truncatesArrays() const { return false; }
+
+  Parser::BlobPolicy blobPolicy() const { return Parser::STORE_BLOB_AS_REFERENCE; }
+
+  Parser::StringPolicy stringPolicy() const { return Parser::STORE_STRING_AS_REFERENCE; }
+
+  void reset() {}
+
+  void reserveValues(size_t) {}
+
+  void storeValue(const StringTreeLeaf& leaf, BuiltinType type, const uint8_t* data, size_t)
+  {
+    CallOnValue( _handler, type, leaf, data );
+  }
+
+  void storeFixedLeaf(const FixedLeaf& leaf, const uint8_t* data)
+  {
+    _leaf.node_ptr    = leaf.node;
+    _leaf.index_array = leaf.index_array;
+    CallOnValue( _handler, leaf.type, _leaf, data + leaf.offset );
+  }
+
+  template <size_t ELEM_SIZE>
+  void storeArray(const StringTreeLeaf& leaf, BuiltinType type, const uint8_t* src, size_t count)
+  {
+    _leaf = leaf;
+    const size_t last = _leaf.index_array.size() - 1;
+    for (size_t i=0; i < count; i++)
+    {
+      _leaf.index_array[last] = i;
+      CallOnValue( _handler, type, _leaf, src + i*ELEM_SIZE );
+    }
+  }
+
+  void storeString(const StringTreeLeaf& leaf, const char* data, size_t size)
+  {
+    _handler.onString( leaf, boost::string_ref( data, size ) );
+  }
+
+  void storeBlob(const StringTreeLeaf& leaf, const uint8_t* data, size_t size)
+  {
+    _handler.onBlob( leaf, Span<uint8_t>( const_cast<uint8_t*>(data), size ) );
+  }
+
+  void finish() {}
+
+private:
+  Handler& _handler;
+  StringTreeLeaf _leaf;
+};
+
+} // end namespace details
+
+} // end namespace RosIntrospection
+
+#endif // ROS_INTROSPECTION_DESERIALIZE_PLAN_H
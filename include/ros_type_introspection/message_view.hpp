@@ -0,0 +1,120 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright 2016-2017 Davide Faconti
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+* *******************************************************************/
+
+
+#ifndef ROS_INTROSPECTION_MESSAGE_VIEW_H
+#define ROS_INTROSPECTION_MESSAGE_VIEW_H
+
+#include <unordered_map>
+#include "ros_type_introspection/stringtree_leaf.hpp"
+#include "ros_type_introspection/helper_functions.hpp"
+
+namespace RosIntrospection{
+
+/**
+ * @brief MessageView provides random access to the fields of a serialized message,
+ * without deserializing the entire buffer.
+ *
+ * Only the offsets required to reach the requested field are computed; fields
+ * with a known size are skipped arithmetically. The offsets found after a
+ * string or a variable-length array are memoized, therefore reading many fields
+ * of the same buffer doesn't parse it again and again.
+ *
+ * Both the ROSMessageInfo and the buffer must outlive the view.
+ *
+ * Example:
+ *
+ *     MessageView view( *parser.getMessageInfo("odometry"), buffer );
+ *     double x = view.value("pose/pose/position/x").convert<double>();
+ */
+class MessageView{
+public:
+
+  MessageView(const ROSMessageInfo& info, Span<uint8_t> buffer);
+
+  /// Reuse the view with another buffer of the same type. Memoized offsets are discarded.
+  void reset(Span<uint8_t> buffer);
+
+  /**
+   * @brief Convert a path such as "pose/pose/position/x" or "name.2" into a StringTreeLeaf.
+   * The path is relative to the root and the array indices take the place of "#".
+   * Indices can be preceded either by "." (as in StringTreeLeaf::toStr) or by "/".
+   * Throws std::runtime_error if the path doesn't exist.
+   */
+  StringTreeLeaf leaf(const std::string& path) const;
+
+  /// Value of a builtin field (or of an element of an array of builtins).
+  Variant value(const StringTreeLeaf& leaf);
+
+  Variant value(const std::string& path) { return value( leaf(path) ); }
+
+  /// Number of elements of an array. The leaf must point to the field, not to its "#".
+  int32_t arraySize(const StringTreeLeaf& leaf);
+
+  int32_t arraySize(const std::string& path) { return arraySize( leaf(path) ); }
+
+private:
+
+  struct Location{
+    size_t offset;
+    const ROSField* field;
+    const MessageTreeNode* msg_node; // not null if field is a message
+    bool is_element;                 // true if offset is the one of an element of an array
+  };
+
+  Location locate(const StringTreeLeaf& leaf);
+
+  size_t fieldOffset(const MessageTreeNode* msg_node, size_t msg_offset,
+                     const StringTreeNode* field_node, LeafKey& key,
+                     const ROSField** field, const MessageTreeNode** field_msg);
+
+  size_t elementOffset(const ROSField& field, const MessageTreeNode* field_msg,
+                       size_t offset, uint16_t index, LeafKey& key);
+
+  size_t skipField(const ROSField& field, const MessageTreeNode* field_msg, size_t offset) const;
+
+  size_t skipElement(const ROSField& field, const MessageTreeNode* field_msg, size_t offset) const;
+
+  size_t skipMessage(const MessageTreeNode* msg_node, size_t offset) const;
+
+  int32_t elementSize(const ROSField& field, const MessageTreeNode* field_msg) const;
+
+  const ROSMessageInfo& _info;
+  Span<uint8_t> _buffer;
+  std::unordered_map<LeafKey, size_t, LeafKeyHash> _offsets;
+};
+
+}
+
+#endif // ROS_INTROSPECTION_MESSAGE_VIEW_H
@@ -39,9 +39,54 @@
 #include <ros_type_introspection/stringtree_leaf.hpp>
 #include <ros_type_introspection/substitution_rule.hpp>
 #include <ros_type_introspection/helper_functions.hpp>
+#include <ros_type_introspection/message_view.hpp>
 
 namespace RosIntrospection{
 
+/**
+ * @brief ShapeCache is used internally by Parser::deserializeIntoFlatContainer.
+ *
+ * It remembers the "shape" of the last message stored in a container, i.e. the
+ * value of all the length prefixes (strings and arrays). If the next buffer has the
+ * same shape, the layout of the container doesn't change: only the values are
+ * copied again from their known offsets.
+ */
+struct ShapeCache {
+
+  ShapeCache(): info(nullptr), value_count(0) {}
+
+  /// nullptr if the cache is not valid.
+  const ROSMessageInfo* info;
+
+  uint32_t plan_version;
+  uint32_t max_array_size;
+  bool discard_large_array;
+  int blob_policy;
+  int string_policy;
+  size_t buffer_size;
+  bool entire_message_parse;
+
+  /// Offset and value of each length prefix.
+  std::vector< std::pair<uint32_t,uint32_t> > prefixes;
+
+  /// Consecutive values with the same type (typically, an array).
+  struct ValueRun{
+    uint32_t offset;
+    uint32_t count;
+    BuiltinType type;
+  };
+  std::vector<ValueRun> values;
+
+  /// Total number of values (sum of ValueRun::count).
+  size_t value_count;
+
+  /// Offset and size of each string.
+  std::vector< std::pair<uint32_t,uint32_t> > strings;
+
+  /// Offset and size of each blob.
+  std::vector< std::pair<uint32_t,uint32_t> > blobs;
+};
+
 struct FlatMessage {
 
   /// Tree that the StringTreeLeaf(s) refer to.
@@ -55,24 +100,194 @@ struct FlatMessage {
   /// This list will be filled by the funtion buildRosFlatType.
   std::vector< std::pair<StringTreeLeaf, std::string> > name;
 
+  /// Used instead of [name] when Parser::STORE_STRING_AS_REFERENCE is selected.
+  /// The strings point to the buffer passed to deserializeIntoFlatContainer.
+  std::vector< std::pair<StringTreeLeaf, boost::string_ref> > name_ref;
+
   /// Store "blobs", i.e all those fields which are vectors of BYTES (AKA uint8_t),
   /// where the vector size is greater than the argument [max_array_size]
   /// passed  to the function deserializeIntoFlatContainer
   std::vector< std::pair<StringTreeLeaf, Span<uint8_t>>> blob;
 
   std::vector<std::vector<uint8_t>> blob_storage;
+
+  ShapeCache shape_cache;
+};
+
+/**
+ * @brief FlatMessageSoA contains the same information of FlatMessage, but the
+ * numerical values are stored as separate, contiguous columns ("structure of arrays").
+ *
+ * The i-th value is described by leaf[i], type[i] and payload[i].
+ * leaf[i] is a compact LeafId that refers to the shared index arena [indices];
+ * use treeLeaf(i) to obtain the equivalent StringTreeLeaf.
+ *
+ * Code that is interested only in the numbers can scan type and payload,
+ * without touching the rest.
+ */
+struct FlatMessageSoA {
+
+  /// Tree that the LeafId(s) refer to.
+  const StringTree* tree;
+
+  /// Identifier of the leaf of each value.
+  std::vector<LeafId> leaf;
+
+  /// BuiltinType of each value.
+  std::vector<uint8_t> type;
+
+  /// Raw memory of each value, copied from the buffer and padded with zeros.
+  /// ros::Time and ros::Duration use the same layout of the serialized message.
+  std::vector<uint64_t> payload;
+
+  /// Array indices of all the values, concatenated. See LeafId::index_offset.
+  std::vector<uint16_t> indices;
+
+  /// Same as FlatMessage::name.
+  std::vector< std::pair<StringTreeLeaf, std::string> > name;
+
+  /// Same as FlatMessage::name_ref.
+  std::vector< std::pair<StringTreeLeaf, boost::string_ref> > name_ref;
+
+  /// Same as FlatMessage::blob.
+  std::vector< std::pair<StringTreeLeaf, Span<uint8_t>>> blob;
+
+  std::vector<std::vector<uint8_t>> blob_storage;
+
+  ShapeCache shape_cache;
+
+  /// Number of numerical values.
+  size_t size() const { return leaf.size(); }
+
+  /// Build the StringTreeLeaf of the i-th value.
+  StringTreeLeaf treeLeaf(size_t i) const
+  {
+    return CreateTreeLeaf( *tree, leaf[i], indices.data() );
+  }
+
+  /// Build the Variant of the i-th value.
+  Variant value(size_t i) const
+  {
+    Variant out;
+    const BuiltinType type_id = static_cast<BuiltinType>( type[i] );
+    out.assignRaw( type_id, reinterpret_cast<const uint8_t*>( &payload[i] ), builtinSize(type_id) );
+    return out;
+  }
 };
 
 typedef std::vector< std::pair<std::string, Variant> > RenamedValues;
 
+/// Same as RenamedValues, but each key is identified by its id in the KeyDictionary of the Parser.
+typedef std::vector< std::pair<uint32_t, Variant> > RenamedKeyIds;
+
+/**
+ * @brief RenameState is used internally by Parser::deserializeAndRename, in place of
+ * a FlatMessage: the values are written directly into RenamedValues and only
+ * their leaves are stored here.
+ */
+struct RenameState {
+
+  RenameState(): blob_count(0) {}
+
+  /// Leaf of each value of the last message.
+  std::vector<StringTreeLeaf> leaf;
+
+  /// Strings of the last message (the aliases). They point to its buffer.
+  std::vector< std::pair<StringTreeLeaf, boost::string_ref> > name_ref;
+
+  /// Blobs are not part of RenamedValues, they are just counted.
+  size_t blob_count;
+
+  ShapeCache shape_cache;
+};
+
+/**
+ * @brief Keys created by Parser::applyNameTransform and Parser::deserializeAndRename.
+ *
+ * Each key has an id that never changes: the dictionary grows only when a new key
+ * appears and the keys are never removed.
+ */
+class KeyDictionary
+{
+public:
+  KeyDictionary() {}
+
+  KeyDictionary(const KeyDictionary& other);
+
+  KeyDictionary& operator=(const KeyDictionary& other);
+
+  /// Id of the key. It is added to the dictionary if missing.
+  uint32_t insert(const std::string& key);
+
+  /// Id of the key, -1 if it is not in the dictionary.
+  int32_t find(const std::string& key) const;
+
+  const std::string& key(uint32_t id) const { return *_keys[id]; }
+
+  size_t size() const { return _keys.size(); }
+
+private:
+  std::unordered_map<std::string, uint32_t> _ids;
+  std::vector<const std::string*> _keys; // they point to the keys of _ids
+};
+
+/**
+ * @brief Result of Parser::tryDeserializeIntoFlatContainer, that doesn't throw exceptions.
+ */
+struct ParseStatus
+{
+  enum Code: uint8_t {
+    OK,
+    UNKNOWN_MESSAGE,   // msg_identifier was not registered
+    BUFFER_OVERRUN,    // a field exceeds the end of the buffer
+    PREFIX_OVERRUN,    // the length prefix of a string or array exceeds the end of the buffer
+    SIZE_MISMATCH,     // the buffer is longer than the message; offset is the size of the message
+    OUT_OF_MEMORY
+  };
+
+  ParseStatus(): code(OK), entire_message_parse(true), offset(0), node(nullptr) {}
+
+  Code code;
+
+  /// If code is OK, same meaning of the value returned by deserializeIntoFlatContainer.
+  bool entire_message_parse;
+
+  /// Position in the buffer where the error was detected.
+  uint32_t offset;
+
+  /// Field that was being parsed when the error was detected (nullptr if unknown).
+  const StringTreeNode* node;
+
+  bool ok() const { return code == OK; }
+};
+
+/**
+ * @brief Convert the numerical values of a FlatMessage to double in one pass.
+ * See ConvertToDouble(const Variant*, size_t, double*, uint64_t*) for the error handling.
+ * [output] and [failed] are resized accordingly.
+ *
+ * @return number of values that could not be converted (they are NaN in [output]).
+ */
+size_t ConvertToDouble(const FlatMessage& msg, std::vector<double>& output, std::vector<uint64_t>& failed);
+
+/// Same as ConvertToDouble(const FlatMessage&, ...), reading the columns type and payload directly.
+size_t ConvertToDouble(const FlatMessageSoA& msg, std::vector<double>& output, std::vector<uint64_t>& failed);
+
+/// Same as ConvertToDouble(const FlatMessage&, ...), for any sequence of Variant(s).
+size_t ConvertToDouble(Span<const Variant> values, std::vector<double>& output, std::vector<uint64_t>& failed);
+
 class Parser{
 
 public:
   Parser(): _rule_cache_dirty(true),
             _global_warnings(&std::cerr),
             _discard_large_array(DISCARD_LARGE_ARRAYS),
-            _blob_policy(STORE_BLOB_AS_COPY)
- {}
+            _blob_policy(STORE_BLOB_AS_COPY),
+            _string_policy(STORE_STRING_AS_COPY),
+            _validation_policy(VALIDATE_WHILE_PARSING)
+ {
+   _last_rename = { nullptr, nullptr, nullptr, 0 };
+ }
 
   enum MaxArrayPolicy: bool {
     DISCARD_LARGE_ARRAYS = true,
@@ -112,6 +327,43 @@ public:
     return _blob_policy;
   }
 
+  enum StringPolicy {
+    STORE_STRING_AS_COPY,
+    STORE_STRING_AS_REFERENCE};
+
+  // If set to STORE_STRING_AS_COPY, the strings are copied into FlatMessage::name.
+  // If STORE_STRING_AS_REFERENCE is used instead, FlatMessage::name_ref is filled with
+  // references to the original buffer. There are no allocations, but the buffer must
+  // outlive the FlatMessage (including the call to applyNameTransform).
+  void setStringPolicy( StringPolicy policy )
+  {
+    _string_policy = policy;
+  }
+
+  StringPolicy stringPolicy() const
+  {
+    return _string_policy;
+  }
+
+  enum ValidationPolicy {
+    VALIDATE_WHILE_PARSING,
+    VALIDATE_BEFORE_PARSING};
+
+  // If set to VALIDATE_WHILE_PARSING, deserializeIntoFlatContainer checks the bounds of every read.
+  // If VALIDATE_BEFORE_PARSING is used instead, the length prefixes are visited once to verify
+  // that the buffer is well formed and has exactly the expected size; the values are then decoded
+  // without any further check. This is usually faster and, in case of error, the exception reports
+  // the offset and the field where the buffer is malformed.
+  void setValidationPolicy( ValidationPolicy policy )
+  {
+    _validation_policy = policy;
+  }
+
+  ValidationPolicy validationPolicy() const
+  {
+    return _validation_policy;
+  }
+
   /**
    * @brief A single message definition will (most probably) generate myltiple ROSMessage(s).
    * In fact the "child" ROSTypes are parsed as well in a recursive and hierarchical way.
@@ -138,6 +390,25 @@ public:
   void registerRenamingRules(const ROSType& type,
                              const std::vector<SubstitutionRule> &rules );
 
+  /**
+   * @brief registerProjection restricts the output of deserializeIntoFlatContainer to a subset
+   * of the fields. The other fields are skipped without being decoded; fields with a known size
+   * are skipped with a single jump. You MUST use registerMessageDefinition first.
+   *
+   * The output is the same that you would get without projection, minus the fields that were
+   * not selected.
+   *
+   * @param msg_identifier  String ID to identify the registered message.
+   * @param paths           Paths in the StringTree, relative to the root and without "#".
+   *                        For instance "pose/pose/position" or "name". A field that is
+   *                        selected brings with it all its children.
+   */
+  void registerProjection(const std::string& msg_identifier,
+                          const std::vector<std::string>& paths);
+
+  /// Remove the projection registered with registerProjection.
+  void removeProjection(const std::string& msg_identifier);
+
   /**
    * @brief getMessageInfo provides some metadata amout a registered ROSMessage.
    *
@@ -177,12 +448,40 @@ public:
    *
    * return true if the entire message was parsed or false if parts of the message were
    * skipped because an array has (size > max_array_size)
+   *
+   * If the previous buffer stored in the same flat_container_output had the same length of all
+   * the strings and arrays, only the values are updated (see ShapeCache).
    */
   bool deserializeIntoFlatContainer(const std::string& msg_identifier,
                                     Span<uint8_t> buffer,
                                     FlatMessage* flat_container_output,
                                     const uint32_t max_array_size ) const;
 
+  /**
+   * @brief Same as the other deserializeIntoFlatContainer, but the numerical values
+   * are stored in the columns of a FlatMessageSoA.
+   */
+  bool deserializeIntoFlatContainer(const std::string& msg_identifier,
+                                    Span<uint8_t> buffer,
+                                    FlatMessageSoA* flat_container_output,
+                                    const uint32_t max_array_size ) const;
+
+  /**
+   * @brief Same as deserializeIntoFlatContainer, but errors are reported by the returned
+   * ParseStatus instead of an exception. This is preferable when corrupted or truncated
+   * buffers are frequent. If an error is reported, the content of flat_container_output is undefined.
+   */
+  ParseStatus tryDeserializeIntoFlatContainer(const std::string& msg_identifier,
+                                              Span<uint8_t> buffer,
+                                              FlatMessage* flat_container_output,
+                                              const uint32_t max_array_size ) const noexcept;
+
+  /// Same as tryDeserializeIntoFlatContainer, using a FlatMessageSoA.
+  ParseStatus tryDeserializeIntoFlatContainer(const std::string& msg_identifier,
+                                              Span<uint8_t> buffer,
+                                              FlatMessageSoA* flat_container_output,
+                                              const uint32_t max_array_size ) const noexcept;
+
   /**
    * @brief applyNameTransform is used to create a vector of type RenamedValues from
    *        the vector FlatMessage::value. Additionally, it apply the renaming rules previously
@@ -199,6 +498,11 @@ public:
    *  - Pose/Quaternion/z = ...
    *  - Pose.Quaternion/w = ...
    *
+   * When the same renamed_value is used again for a message with the same identifier,
+   * the same leaves and the same strings (for instance the names of a JointState), the keys
+   * are not written again: only the values are copied. Therefore, don't modify the keys
+   * of renamed_value between two calls.
+   *
    * @param msg_identifier  String ID to identify the registered message (use registerMessageDefinition first).
    * @param container       Source. This instance must be created using deserializeIntoFlatContainer.
    * @param renamed_value   Destination.
@@ -207,6 +511,61 @@ public:
                           const FlatMessage& container,
                           RenamedValues* renamed_value , bool dont_add_topicname = false);
 
+  /**
+   * @brief Same as applyNameTransform, but the keys are stored as ids of keyDictionary().
+   *        Consecutive messages with the same leaves and names don't even look up the dictionary.
+   */
+  void applyNameTransform(const std::string& msg_identifier,
+                          const FlatMessage& container,
+                          RenamedKeyIds* renamed_value , bool dont_add_topicname = false);
+
+  /// Dictionary of all the keys created by applyNameTransform and deserializeAndRename.
+  const KeyDictionary& keyDictionary() const { return _key_dictionary; }
+
+  /**
+   * @brief deserializeAndRename gives the same result of deserializeIntoFlatContainer followed
+   *        by applyNameTransform, but the values are decoded directly into renamed_value:
+   *        no FlatMessage is created. The keys are created with the same rules (see registerRenamingRules).
+   *
+   * Like applyNameTransform, the keys are not written again if the message has the same leaves
+   * and names of the previous one; only the values are decoded.
+   *
+   * @param msg_identifier  String ID to identify the registered message (use registerMessageDefinition first).
+   * @param buffer          raw memory to be parsed.
+   * @param renamed_value   Destination. Its content is not valid if an exception is thrown.
+   * @param max_array_size  as in deserializeIntoFlatContainer.
+   * @param skip_topicname  remove the root from the keys.
+   *
+   * @return true if the entire message was parsed or false if parts of the message were
+   *         skipped because an array has (size > max_array_size)
+   */
+  bool deserializeAndRename(const std::string& msg_identifier,
+                            Span<uint8_t> buffer,
+                            RenamedValues* renamed_value,
+                            const uint32_t max_array_size,
+                            bool skip_topicname = false);
+
+  /// Same as deserializeAndRename, but the keys are stored as ids of keyDictionary().
+  bool deserializeAndRename(const std::string& msg_identifier,
+                            Span<uint8_t> buffer,
+                            RenamedKeyIds* renamed_value,
+                            const uint32_t max_array_size,
+                            bool skip_topicname = false);
+
+  /**
+   * @brief Same string created by CreateStringFromTreeLeaf, but formatted only the first time
+   *        a leaf is seen: the messages with the same identifier share the same names.
+   *        Used by applyNameTransform for the values that are not renamed.
+   *
+   * The reference remains valid as long as the Parser (see keyDictionary()).
+   *
+   * @param msg_identifier  String ID to identify the registered message (use registerMessageDefinition first).
+   * @param leaf            A leaf of the StringTree of that message.
+   * @param skip_topicname  remove the root from the name.
+   */
+  const std::string& leafName(const std::string& msg_identifier,
+                              const StringTreeLeaf& leaf, bool skip_topicname = false);
+
   typedef std::function<void(const ROSType&, Span<uint8_t>&)> VisitingCallback;
 
   /**
@@ -228,6 +587,34 @@ public:
   template <typename T>
   T extractField(const std::string& msg_identifier, const Span<uint8_t> &buffer);
 
+  /**
+   * @brief deserialize passes each field of the buffer to the handler, using its native type.
+   *        No FlatMessage or Variant is created and, since the type of the handler is known
+   *        at compile time, the calls can be inlined.
+   *
+   * The Handler must provide these methods:
+   *
+   *  - onValue(const StringTreeLeaf&, T value), where T is bool, int8_t, uint8_t, ..., float, double,
+   *    ros::Time or ros::Duration (a template method works too). CHAR is passed as int8_t.
+   *  - onString(const StringTreeLeaf&, boost::string_ref): the string points to the buffer.
+   *  - onBlob(const StringTreeLeaf&, Span<uint8_t>): arrays of elements with size 1 (uint8_t, bool, etc.)
+   *    larger than max_array_size, as in deserializeIntoFlatContainer. The Span points to the buffer.
+   *
+   * Unlike deserializeIntoFlatContainer, all the elements of the other arrays are passed,
+   * whatever their size. The projection (see registerProjection) is applied.
+   * Malformed buffers throw the same exceptions of deserializeIntoFlatContainer.
+   *
+   * @param msg_identifier  String ID to identify the registered message (use registerMessageDefinition first).
+   * @param buffer          raw memory to be parsed.
+   * @param handler         receives the fields in the same order of deserializeIntoFlatContainer.
+   * @param max_array_size  arrays of bytes larger than this are passed to onBlob.
+   */
+  template <class Handler>
+  void deserialize(const std::string& msg_identifier,
+                   Span<uint8_t> buffer,
+                   Handler& handler,
+                   const uint32_t max_array_size = 100) const;
+
 
   /// Change where the warning messages are displayed.
   void setWarningsStream(std::ostream* output) { _global_warnings = output; }
@@ -237,35 +624,171 @@ private:
 
   struct RulesCache{
     RulesCache( const SubstitutionRule& r):
-      rule( &r ), pattern_head(nullptr), alias_head(nullptr)
+      rule( &r ), first_table(0)
     {}
     const SubstitutionRule* rule;
-    const StringTreeNode* pattern_head;
-    const StringTreeNode* alias_head;
+    /// TreeNode::index() of every occurrence of the pattern, parents first.
+    std::vector<uint32_t> pattern_heads;
+    /// TreeNode::index() of every occurrence of the alias, parents first.
+    std::vector<uint32_t> alias_heads;
+    /// For each occurrence of the alias, position in StringTreeLeaf::index_array of its "#",
+    /// -1 if there is none or if the occurrence is inside another one.
+    std::vector<int16_t> alias_pos;
+    /// Position in alias_heads of the occurrence that contains each node, -1 if none.
+    /// Indexed by TreeNode::index().
+    std::vector<int32_t> alias_of_node;
+    /// Table of the first occurrence of the alias (see updateKeyIds). The other ones follow.
+    uint32_t first_table;
     bool operator==(const RulesCache& other) { return  this->rule == other.rule; }
   };
 
+  /// Piece of a renamed key: a fixed text, an index of StringTreeLeaf::index_array or the alias.
+  struct RenameToken{
+    enum Kind: uint8_t { TEXT, INDEX, ALIAS };
+    Kind kind;
+    uint16_t index_pos;
+    std::string text;
+  };
+
+  /**
+   * Key of a leaf renamed by a rule, compiled by updateRuleCache.
+   * The tokens are joined with '/', as in "JointState" "/" alias "/" "pos".
+   */
+  struct RenameTemplate{
+    uint32_t rule;         // position in TransformCache::rules
+    std::vector<uint32_t> alias_tables; // occurrences of the alias, closest to the pattern first
+    uint16_t pattern_pos;  // index of StringTreeLeaf::index_array used to find the alias
+    std::vector<RenameToken> tokens[2]; // [skip_topicname]
+  };
+
   std::unordered_map<std::string, ROSMessageInfo> _registered_messages;
   std::unordered_map<ROSType,     std::unordered_set<SubstitutionRule>>   _registered_rules;
-  std::unordered_map<std::string, std::vector<RulesCache>>  _rule_caches;
 
   void updateRuleCache();
 
+  /// Keys of the leaves that are not renamed (see leafName).
+  struct LeafNameCache{
+    LeafNameCache() {}
+    // [last] points to the entries of the original: a copy starts empty.
+    LeafNameCache(const LeafNameCache&) {}
+    LeafNameCache& operator=(const LeafNameCache&) { clear(); return *this; }
+
+    void clear()
+    {
+      index[0].clear(); index[1].clear();
+      last[0].clear();  last[1].clear();
+    }
+
+    typedef std::unordered_map<LeafKey, uint32_t, LeafKeyHash> Index; // id in the KeyDictionary
+    Index index[2]; // [skip_topicname]
+    /// Entry used for each value by the last call of applyNameTransform.
+    std::vector<const Index::value_type*> last[2];
+  };
+
+  /// State of applyNameTransform, for each message identifier.
+  struct TransformCache{
+    TransformCache(): alias_table_count(0), key_version(0) {}
+    std::vector<RulesCache> rules;
+    /// Total number of occurrences of the aliases of all the rules.
+    uint32_t alias_table_count;
+    /// Rules that may rename each node (in the same order of rules), indexed by TreeNode::index().
+    std::vector<std::vector<RenameTemplate>> templates;
+    LeafNameCache leaf_names;
+    /// skip_topicname, leaves and names of the last message (see updateKeyIds). Empty when the rules change.
+    std::string fingerprint;
+    /// Key of each value of the last message, as id of the KeyDictionary.
+    std::vector<uint32_t> key_ids;
+    /// Incremented when key_ids changes.
+    uint32_t key_version;
+    /// Used by deserializeAndRename.
+    RenameState state;
+  };
+  std::unordered_map<std::string, TransformCache> _transform_caches;
+
+  KeyDictionary _key_dictionary;
+
+  /// Last RenamedValues written by applyNameTransform or deserializeAndRename: if the
+  /// key_ids of the same TransformCache didn't change, its keys are still valid.
+  struct LastRename{
+    const RenamedValues* output;
+    const void* data;
+    const TransformCache* cache;
+    uint32_t key_version;
+  };
+  LastRename _last_rename;
+  std::string _fingerprint;
+  std::string _key_buffer;
+
+  static void compileRenameTemplates(const StringTree& tree, TransformCache& cache);
+
+  // Common part of applyNameTransform and deserializeAndRename: update cache.key_ids with the keys
+  // of [count] leaves, where leafAt(i) returns the i-th one. The names must be in _names already.
+  template <class LeafAt>
+  void updateKeyIds(TransformCache& cache, LeafAt leafAt, size_t count, bool skip_topicname);
+
+  void writeKeys(const TransformCache& cache, RenamedValues* renamed_value);
+
+  void writeKeys(const TransformCache& cache, RenamedKeyIds* renamed_value);
+
+  template <class Output>
+  void applyNameTransformInto(const std::string& msg_identifier, const FlatMessage& container,
+                              Output* renamed_value, bool skip_topicname);
+
+  template <class Output>
+  bool deserializeAndRenameInto(const std::string& msg_identifier, Span<uint8_t> buffer,
+                                Output* renamed_value, const uint32_t max_array_size, bool skip_topicname);
+
+  const LeafNameCache::Index::value_type& findLeafName(LeafNameCache& cache,
+                                                       const StringTreeLeaf& leaf,
+                                                       bool skip_topicname);
+
   bool _rule_cache_dirty;
 
   void createTrees(ROSMessageInfo &info, const std::string &type_name) const;
 
+  void compilePlan(ROSMessageInfo &info) const;
+
   std::ostream* _global_warnings;
 
-  std::vector<int> _alias_array_pos;
-  std::vector<std::string> _formatted_string;
-  std::vector<int8_t> _substituted;
+  /// For each occurrence of the alias of each rule, alias of each index of the array (nullptr if missing).
+  /// See updateKeyIds.
+  std::vector<std::vector<const boost::string_ref*>> _alias_tables;
   MaxArrayPolicy _discard_large_array;
   BlobPolicy _blob_policy;
+  StringPolicy _string_policy;
+  ValidationPolicy _validation_policy;
+  std::vector< std::pair<const StringTreeLeaf*, boost::string_ref> > _names;
 };
 
+} // end namespace RosIntrospection
+
+#include <ros_type_introspection/details/deserialize_plan.hpp>
+
+namespace RosIntrospection{
+
 //---------------------------------------------------
 
+template <class Handler> inline
+void Parser::deserialize(const std::string& msg_identifier,
+                         Span<uint8_t> buffer,
+                         Handler& handler,
+                         const uint32_t max_array_size) const
+{
+  const ROSMessageInfo* msg_info = getMessageInfo(msg_identifier);
+  if( msg_info == nullptr)
+  {
+    throw std::runtime_error("deserialize: msg_identifier not registered. Use registerMessageDefinition" );
+  }
+
+  details::HandlerWriter<Handler> writer( handler );
+  const ParseStatus status = details::Deserialize( *msg_info, buffer, max_array_size, false,
+                                                   _validation_policy, writer );
+  if( !status.ok() )
+  {
+    details::ThrowParseError( status, msg_identifier, buffer.size(), _validation_policy );
+  }
+}
+
 template<typename T> inline
 T Parser::extractField(const std::string &msg_identifier,
                        const Span<uint8_t> &buffer)
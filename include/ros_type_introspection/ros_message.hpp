@@ -35,6 +35,7 @@
 #ifndef ROS_INTROSPECTION_ROSMESSAGE_H
 #define ROS_INTROSPECTION_ROSMESSAGE_H
 
+#include <boost/container/static_vector.hpp>
 #include "ros_type_introspection/utils/tree.hpp"
 #include "ros_type_introspection/ros_field.hpp"
 
@@ -71,17 +72,138 @@ private:
   std::vector<ROSField> _fields;
 };
 
+/**
+ * @brief Split the full definition of a message (as in the connection header of a rosbag)
+ * into the definitions of the message itself and of the types it depends on.
+ *
+ * They are separated by lines of "=", each of them parsed by ROSMessage::ROSMessage.
+ */
+std::vector<std::string> SplitMessageDefinitions(const std::string& definition);
+
+/**
+ * @brief Full path of a StringTreeNode, such as "joint/position.#", where each "#"
+ * is replaced by the corresponding index of StringTreeLeaf::index_array.
+ * Computed once by BuildPathTemplates, so that a leaf can be printed without
+ * visiting its parents.
+ */
+struct StringTreePath
+{
+  StringTreePath(): root_size(0) {}
+
+  std::string text;
+
+  /// Position of each "#" in text.
+  boost::container::static_vector<uint16_t,8> placeholders;
+
+  /// Characters to skip to remove the root (and the following separator) from text.
+  uint16_t root_size;
+};
+
+namespace details{
+template <> struct TreeNodeData<std::string>
+{
+  StringTreePath path;
+};
+}
+
 typedef details::TreeNode<std::string> StringTreeNode;
 typedef details::Tree<std::string> StringTree;
 
 typedef details::TreeNode<const ROSMessage*> MessageTreeNode;
 typedef details::Tree<const ROSMessage*> MessageTree;
 
+/**
+ * @brief Single step of the linear program that Parser::registerMessageDefinition
+ * compiles out of the MessageTree.
+ *
+ * Nested messages are inlined, therefore each instruction already knows the
+ * StringTreeNode it refers to and the deserializer doesn't need any recursion.
+ */
+struct PlanInstruction
+{
+  enum OpCode: uint8_t {
+    READ_BUILTIN, // a single builtin value, STRING excluded
+    READ_STRING,  // a single string
+    READ_ARRAY,   // an array of builtins (or strings)
+    BEGIN_LOOP,   // an array of messages. The body is followed by END_LOOP
+    END_LOOP,
+    DESCEND,      // a single nested message. The body is followed by ASCEND
+    ASCEND,
+    SKIP_BYTES,   // fields with a fixed size that are not part of a projection
+    SKIP_ARRAY,   // variable-length array of elements with fixed size, not part of a projection
+    SKIP_STRING   // string (or array of strings) that is not part of a projection
+  };
+
+  OpCode op;
+
+  BuiltinType type;
+
+  /// Same as ROSField::arraySize(): -1 means that the length prefix must be read from the buffer.
+  /// SKIP_BYTES: size of the largest array among the skipped fields.
+  int32_t array_size;
+
+  /// BEGIN_LOOP / DESCEND: index of the instruction after the closing one.
+  /// END_LOOP / ASCEND: index of the first instruction of the body.
+  uint32_t jump;
+
+  /// SKIP_BYTES: number of bytes to skip. SKIP_ARRAY: size of each element.
+  /// BEGIN_LOOP / DESCEND: serialized size of the nested message, 0 if it is not fixed.
+  uint32_t size;
+
+  /// SKIP_BYTES / SKIP_ARRAY: size of the largest array inside the skipped nested messages.
+  uint32_t nested_array_size;
+
+  /// Node of the field. For arrays, this is the "#" child.
+  const StringTreeNode* node;
+};
+
+/**
+ * @brief Position of a leaf inside a message that has a fixed size,
+ * i.e. without strings and variable-length arrays.
+ */
+struct FixedLeaf
+{
+  uint32_t offset;
+  uint32_t size;
+  BuiltinType type;
+  const StringTreeNode* node;
+  boost::container::static_vector<uint16_t,8> index_array;
+};
+
 struct ROSMessageInfo
 {
+  ROSMessageInfo(): fixed_size(-1), fixed_max_array_size(0), has_projection(false), plan_version(0) {}
+
   StringTree  string_tree;
   MessageTree message_tree;
   std::vector<ROSMessage> type_list;
+
+  /// Flat sequence of instructions used by Parser::deserializeIntoFlatContainer.
+  std::vector<PlanInstruction> plan;
+
+  /// Size of the serialized message if it is known in advance, -1 otherwise.
+  int32_t fixed_size;
+
+  /// Size of the largest array contained in a message with fixed_size.
+  uint32_t fixed_max_array_size;
+
+  /// Serialized size of each node of message_tree (see TreeNode::index), -1 if not fixed.
+  std::vector<int32_t> message_size;
+
+  /// If fixed_size >= 0, offset and type of each leaf (empty otherwise).
+  std::vector<FixedLeaf> fixed_layout;
+
+  /// True if Parser::registerProjection was used.
+  bool has_projection;
+
+  /// Same as plan, but the fields that are not part of the projection are skipped.
+  std::vector<PlanInstruction> projected_plan;
+
+  /// Subset of fixed_layout that is part of the projection.
+  std::vector<FixedLeaf> projected_layout;
+
+  /// Incremented every time the projection changes.
+  uint32_t plan_version;
 };
 
 //------------------------------------------------
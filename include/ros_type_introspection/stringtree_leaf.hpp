@@ -89,6 +89,73 @@ struct StringTreeLeaf{
 
 void CreateStringFromTreeLeaf(const StringTreeLeaf& leaf, bool skip_root, std::string &out);
 
+/// Compute StringTreeNode::path for each node of the tree, once the tree is complete
+/// (see StringTree::indexNodes). It is required by StringTreeLeaf::toStr and CreateStringFromTreeLeaf.
+void BuildPathTemplates(StringTree& tree);
+
+/**
+ * @brief TreeNode::index() of the node with the given path, -1 if it doesn't exist.
+ *
+ * The path is relative to the root, for instance "pose/pose/position/x".
+ * Both "/" and "." are accepted as separators. The element of an array can be
+ * written as "#" or as an index, for instance "name.#" or "name/3"; it can also be omitted
+ * before the field of an array of messages ("items/values" is the same as "items/#/values").
+ * Each step is a hashed lookup (see Tree::findChild).
+ */
+int32_t FindNodeByPath(const StringTree& tree, boost::string_ref path);
+
+/// Reverse of FindNodeByPath: the path of a node relative to the root, such as "name.#".
+inline boost::string_ref PathOfNode(const StringTree& tree, uint32_t node_index)
+{
+  const StringTreePath& path = tree.node( node_index )->path;
+  const size_t first = std::min<size_t>( path.root_size, path.text.size() );
+  return boost::string_ref( path.text ).substr( first );
+}
+
+/**
+ * @brief Compact alternative to StringTreeLeaf, used by FlatMessageSoA.
+ *
+ * Instead of a pointer and a copy of the index_array, it stores the
+ * TreeNode::index() of the node and the position of the index_array in an
+ * arena owned by the container. The length of the index_array is equal to
+ * the number of "#" in the path of the node.
+ */
+struct LeafId{
+  uint32_t node_index;
+  uint32_t index_offset;
+};
+
+/// Rebuild the StringTreeLeaf identified by a LeafId. [index_arena] is the arena of the container.
+StringTreeLeaf CreateTreeLeaf(const StringTree& tree, const LeafId& id, const uint16_t* index_arena);
+
+/**
+ * @brief Hashable copy of a StringTreeLeaf, that doesn't depend on the address of the tree.
+ * Used as key of the caches that are indexed by leaf.
+ */
+struct LeafKey{
+  LeafKey(): node_index(0) {}
+  explicit LeafKey(const StringTreeLeaf& leaf): node_index( leaf.node_ptr->index() ), index_array( leaf.index_array ) {}
+
+  uint32_t node_index;
+  boost::container::static_vector<uint16_t,8> index_array;
+
+  bool operator==(const LeafKey& other) const {
+    return node_index == other.node_index && index_array == other.index_array;
+  }
+};
+
+struct LeafKeyHash{
+  size_t operator()(const LeafKey& key) const
+  {
+    size_t hash = key.node_index;
+    for (uint16_t index: key.index_array)
+    {
+      hash = hash * 31 + index;
+    }
+    return hash;
+  }
+};
+
 //---------------------------------
 
 inline std::ostream& operator<<(std::ostream &os, const StringTreeLeaf& leaf )
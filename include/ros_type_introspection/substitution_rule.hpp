@@ -37,6 +37,8 @@
 #define ROS_INTROSPECTION_SUBSTITUTION_RULE_H
 
 #include "ros_type_introspection/ros_type.hpp"
+#include "ros_type_introspection/ros_message.hpp"
+#include <unordered_map>
 #include <boost/utility/string_ref.hpp>
 
 
@@ -106,6 +108,9 @@ public:
    *
    *     JointState/first_joint.pos = 11
    *
+   * Each element of the pattern and of the alias can also be the wildcard __*__, that matches
+   * any single field. If the pattern is found more than once in the message, all the occurrences are renamed.
+   * If the alias is found more than once, the names of the one closest to the pattern are used.
    *
    * @param pattern        The pattern to be found in FlatMessage::value.
    * @param alias          The name_id that substitutes the number in the pattern. To be found in FlatMessage::name.
@@ -141,6 +146,40 @@ private:
 
 typedef std::map<ROSType, std::vector<SubstitutionRule>> SubstitutionRuleMap;
 
+/**
+ * @brief Trie of many patterns (see SubstitutionRule::pattern and SubstitutionRule::alias),
+ * matched against all the nodes of a StringTree in a single visit.
+ *
+ * A pattern ends in a node if the last elements of the path of that node are equal to the
+ * pattern. "#" matches the "#" nodes, as any other name, while "*" matches any node.
+ */
+class PatternTrie
+{
+public:
+  PatternTrie();
+
+  /// Add a pattern. Its id is equal to the number of patterns added before.
+  uint32_t addPattern(const std::vector<boost::string_ref>& pattern);
+
+  /// For each pattern id, the TreeNode::index() of the nodes where the pattern ends.
+  /// Parents precede their children.
+  std::vector< std::vector<uint32_t> > match(const StringTree& tree) const;
+
+private:
+  struct State{
+    State(): wildcard(-1) {}
+    std::unordered_map<std::string, uint32_t> next;
+    int32_t wildcard;               // state after a "*", -1 if none
+    std::vector<uint32_t> patterns; // patterns that end in this state
+  };
+
+  void visit(const StringTreeNode* node, const std::vector<uint32_t>& parent_states,
+             std::vector< std::vector<uint32_t> >& result) const;
+
+  std::vector<State> _states; // _states[0] is the root
+  uint32_t _pattern_count;
+};
+
 } // end namespace
 
 
@@ -40,65 +40,148 @@
 #include <deque>
 #include <iostream>
 #include <memory>
-#include <boost/container/stable_vector.hpp>
-#include <boost/noncopyable.hpp>
+#include <functional>
+#include <boost/utility/string_ref.hpp>
 
 
 namespace RosIntrospection {
 
 namespace details{
 
+/**
+ * @brief Contiguous sequence of nodes, used to iterate the children of a TreeNode.
+ */
+template <typename Node> class NodeRange
+{
+public:
+  NodeRange(Node* first, size_t size): _first(first), _size(size) {}
+
+  Node* begin() const { return _first; }
+  Node* end() const   { return _first + _size; }
+
+  size_t size() const { return _size; }
+  bool empty() const  { return _size == 0; }
+
+  Node& operator[](size_t index) const { return _first[index]; }
+  Node& front() const { return _first[0]; }
+  Node& back() const  { return _first[_size-1]; }
+
+private:
+  Node*  _first;
+  size_t _size;
+};
+
+template <typename T> class Tree;
+
+/// Hash used by Tree::findChild. Strings and string_ref with the same characters have the same hash.
+inline size_t HashTreeValue(const char* data, size_t size)
+{
+  size_t hash = 14695981039346656037ULL; // FNV-1a
+  for (size_t i=0; i<size; i++)
+  {
+    hash = (hash ^ static_cast<uint8_t>(data[i])) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+inline size_t HashTreeValue(const std::string& value)       { return HashTreeValue( value.data(), value.size() ); }
+inline size_t HashTreeValue(const boost::string_ref& value) { return HashTreeValue( value.data(), value.size() ); }
+inline size_t HashTreeValue(const char* value)              { return HashTreeValue( boost::string_ref(value) ); }
+
+template <typename T> inline size_t HashTreeValue(const T& value) { return std::hash<T>()(value); }
+
+/**
+ * @brief Additional data stored in each TreeNode<T>. Empty unless specialized for T.
+ */
+template <typename T> struct TreeNodeData {};
+
 /**
  * @brief Element of the tree. it has a single parent and N >= 0 children.
+ *
+ * All the nodes of a Tree are stored in a single array. Parent and children are
+ * referenced by their distance from this node, therefore a copy of the array
+ * is still a valid Tree.
  */
-template <typename T> class TreeNode
+template <typename T> class TreeNode: public TreeNodeData<T>
 {
 
 public:
 
-  typedef std::vector<TreeNode> ChildrenVector; // dangerous because of pointer invalidation (but faster)
+  typedef NodeRange<const TreeNode> ChildrenVector;
 
-  TreeNode(const TreeNode* parent );
+  TreeNode(): _parent(0), _first_child(0), _child_count(0), _index(0) {}
 
-  const TreeNode* parent() const  { return _parent; }
+  const TreeNode* parent() const  { return _parent ? this + _parent : nullptr; }
 
   const T& value() const          { return _value; }
   void setValue( const T& value)  { _value = value; }
 
-  const ChildrenVector& children()const   { return _children; }
-  ChildrenVector& children()              { return _children; }
+  ChildrenVector children() const             { return ChildrenVector( this + _first_child, _child_count ); }
+  NodeRange<TreeNode> children()              { return NodeRange<TreeNode>( this + _first_child, _child_count ); }
 
-  const TreeNode* child(size_t index) const { return &(_children[index]); }
-  TreeNode* child(size_t index) { return &(_children[index]); }
+  const TreeNode* child(size_t index) const { return this + _first_child + index; }
+  TreeNode* child(size_t index) { return this + _first_child + index; }
 
-  TreeNode *addChild(const T& child );
+  bool isLeaf() const { return _child_count == 0; }
 
-  bool isLeaf() const { return _children.empty(); }
+  /// Position of the node inside the Tree. Valid after Tree::indexNodes().
+  uint32_t index() const { return _index; }
 
 private:
-  const TreeNode*   _parent;
-  T                 _value;
-  ChildrenVector    _children;
+  template <typename> friend class Tree;
+
+  T         _value;
+  int32_t   _parent;       // distance from this node, 0 for the root
+  int32_t   _first_child;  // distance from this node
+  uint32_t  _child_count;
+  uint32_t  _index;
 };
 
 
+/**
+ * @brief Tree stored as a single array of TreeNode(s).
+ *
+ * The tree is built using addChild(), that refers to the nodes by their index:
+ * no pointer can be invalidated while the tree grows. Then indexNodes() sorts the
+ * nodes in depth-first order, keeping the children of each node next to each other.
+ * TreeNode::children() and TreeNode::parent() are valid only after indexNodes().
+ */
 template <typename T> class Tree
 {
 public:
-  Tree(): _root( new TreeNode<T>(nullptr) ) {}
+  Tree(): _nodes(1), _parents(1, 0) {}
 
   /**
      * Find a set of elements in the tree and return the pointer to the leaf.
      * The first element of the concatenated_values should be a root of the Tree.
      * The leaf corresponds to the last element of concatenated_values in the Tree.
      */
-  template<typename Vect> const TreeNode<T>* find( const Vect& concatenated_values, bool partial_allowed = false);
+  template<typename Vect> const TreeNode<T>* find( const Vect& concatenated_values, bool partial_allowed = false) const;
+
+  /// Child of [parent] with the given value, nullptr if not found.
+  /// It uses a hash table built by indexNodes(), instead of visiting all the children.
+  template<typename V> const TreeNode<T>* findChild( const TreeNode<T>* parent, const V& value) const;
 
   /// Constant pointer to the root of the tree.
-  const TreeNode<T>* croot() const { return _root.get(); }
+  const TreeNode<T>* croot() const { return &_nodes.front(); }
 
   /// Mutable pointer to the root of the tree.
-  TreeNode<T>* root() { return _root.get(); }
+  TreeNode<T>* root() { return &_nodes.front(); }
+
+  /// Add a new node, child of the one with index [parent_index] (the root has index 0).
+  /// Returns the index of the new node, valid until indexNodes() is called.
+  uint32_t addChild(uint32_t parent_index, const T& value);
+
+  /// Sort the nodes in depth-first order and assign TreeNode::index().
+  /// Must be called again if the tree is modified.
+  void indexNodes();
+
+  /// Node with the given TreeNode::index().
+  const TreeNode<T>* node(uint32_t index) const { return &_nodes[index]; }
+  TreeNode<T>* node(uint32_t index) { return &_nodes[index]; }
+
+  /// Number of nodes.
+  size_t size() const { return _nodes.size(); }
 
 
   friend std::ostream& operator<<(std::ostream& os, const Tree& _this){
@@ -110,7 +193,19 @@ private:
 
   void print_impl(std::ostream& os, const TreeNode<T> *node, int indent ) const;
 
-  std::unique_ptr<TreeNode<T>> _root;
+  std::vector<TreeNode<T>> _nodes;
+
+  // Index of the parent of each node, used by addChild before indexNodes().
+  std::vector<uint32_t> _parents;
+
+  // Open addressing hash table of the nodes, where the key is (parent, value).
+  // 0 is an empty slot (the root is never the child of another node).
+  std::vector<uint32_t> _child_table;
+
+  static size_t childHash(uint32_t parent_index, size_t value_hash)
+  {
+    return value_hash ^ (static_cast<size_t>(parent_index + 1) * 0x9E3779B97F4A7C15ULL);
+  }
 };
 
 //-----------------------------------------
@@ -160,40 +255,126 @@ void Tree<T>::print_impl(std::ostream &os, const TreeNode<T>* node, int indent)
 }
 
 template <typename T> inline
-TreeNode<T>::TreeNode(const TreeNode *parent):
-  _parent(parent)
+uint32_t Tree<T>::addChild(uint32_t parent_index, const T& value)
 {
-
+  const uint32_t index = _nodes.size();
+  _nodes.push_back( TreeNode<T>() );
+  _nodes.back().setValue( value );
+  _parents.push_back( parent_index );
+  return index;
 }
 
 template <typename T> inline
-TreeNode<T> *TreeNode<T>::addChild(const T& value)
+void Tree<T>::indexNodes()
 {
-  assert(_children.capacity() > _children.size() );
-  _children.push_back( TreeNode<T>(this) );
-  _children.back().setValue( value );
-  return &_children.back();
+  const uint32_t count = _nodes.size();
+
+  // children of each node, in the order they were added (counting sort by parent)
+  std::vector<uint32_t> first_child( count + 1, 0 );
+  for (uint32_t i=1; i<count; i++)
+  {
+    first_child[ _parents[i] + 1 ]++;
+  }
+  for (uint32_t i=0; i<count; i++)
+  {
+    first_child[i+1] += first_child[i];
+  }
+  std::vector<uint32_t> children( count );
+  {
+    std::vector<uint32_t> next( first_child.begin(), first_child.end() - 1 );
+    for (uint32_t i=1; i<count; i++)
+    {
+      children[ next[_parents[i]]++ ] = i;
+    }
+  }
+
+  // new position of each node: the children of a node are placed together,
+  // then the subtree of each child is visited.
+  std::vector<uint32_t> position( count, 0 );
+  uint32_t next_position = 1;
+  std::function<void(uint32_t)> placeChildren = [&](uint32_t node)
+  {
+    for (uint32_t c = first_child[node]; c < first_child[node+1]; c++)
+    {
+      position[ children[c] ] = next_position++;
+    }
+    for (uint32_t c = first_child[node]; c < first_child[node+1]; c++)
+    {
+      placeChildren( children[c] );
+    }
+  };
+  placeChildren( 0 );
+
+  std::vector<TreeNode<T>> sorted( count );
+  for (uint32_t i=0; i<count; i++)
+  {
+    TreeNode<T>& node = sorted[ position[i] ];
+    const int32_t pos = position[i];
+    node = std::move( _nodes[i] );
+    node._index  = pos;
+    node._parent = (i == 0) ? 0 : static_cast<int32_t>( position[ _parents[i] ] ) - pos;
+    node._child_count = first_child[i+1] - first_child[i];
+    node._first_child = (node._child_count == 0) ? 0 :
+        static_cast<int32_t>( position[ children[ first_child[i] ] ] ) - pos;
+  }
+  _nodes.swap( sorted );
+
+  for (uint32_t i=0; i<count; i++)
+  {
+    const TreeNode<T>* parent = _nodes[i].parent();
+    _parents[i] = parent ? parent->index() : 0;
+  }
+
+  size_t table_size = 8;
+  while( table_size < 2*count )
+  {
+    table_size *= 2;
+  }
+  _child_table.assign( table_size, 0 );
+  const size_t mask = table_size - 1;
+  for (uint32_t i=1; i<count; i++)
+  {
+    size_t slot = childHash( _parents[i], HashTreeValue( _nodes[i].value() ) ) & mask;
+    while( _child_table[slot] != 0 )
+    {
+      slot = (slot + 1) & mask;
+    }
+    _child_table[slot] = i;
+  }
 }
 
+template <typename T> template<typename V> inline
+const TreeNode<T> *Tree<T>::findChild(const TreeNode<T>* parent, const V& value) const
+{
+  if( _child_table.empty() )
+  {
+    return nullptr;
+  }
+  const size_t mask = _child_table.size() - 1;
+  const uint32_t parent_index = parent->index();
+  size_t slot = childHash( parent_index, HashTreeValue( value ) ) & mask;
+
+  while( _child_table[slot] != 0 )
+  {
+    const uint32_t index = _child_table[slot];
+    if( _parents[index] == parent_index && _nodes[index].value() == value )
+    {
+      return &_nodes[index];
+    }
+    slot = (slot + 1) & mask;
+  }
+  return nullptr;
+}
 
 template <typename T> template<typename Vect> inline
-const TreeNode<T> *Tree<T>::find(const Vect& concatenated_values, bool partial_allowed )
+const TreeNode<T> *Tree<T>::find(const Vect& concatenated_values, bool partial_allowed ) const
 {
-  TreeNode<T>* node = &_root;
+  const TreeNode<T>* node = croot();
 
   for (const auto& value: concatenated_values)
   {
-    bool found = false;
-    for (auto& child: (node->children() ) )
-    {
-      if( child.value() == value)
-      {
-        node = &(child);
-        found = true;
-        break;
-      }
-    }
-    if( !found ) return nullptr;
+    node = findChild( node, value );
+    if( !node ) return nullptr;
   }
 
   if( partial_allowed || node->children().empty() )
@@ -37,6 +37,7 @@
 
 #include <type_traits>
 #include <limits>
+#include <cstring>
 #include <boost/utility/string_ref.hpp>
 #include "ros_type_introspection/builtin_types.hpp"
 #include "ros_type_introspection/details/exceptions.hpp"
@@ -46,59 +47,64 @@
 namespace RosIntrospection
 {
 
+namespace details{
+template <class VariantAt>
+size_t ConvertVariantsToDouble(VariantAt variantAt, size_t count, double* output, uint64_t* failed);
+}
+
 class Variant
 {
 
 public:
 
-  Variant() {
-    _type = OTHER;
-    _storage.raw_string = nullptr;
+  Variant(): _string_storage(HEAP_STRING), _type(OTHER)
+  {
+    setRawString(nullptr);
   }
 
   ~Variant();
 
-  Variant(const Variant& other): _type(OTHER)
+  Variant(const Variant& other): _string_storage(HEAP_STRING), _type(OTHER)
   {
-    if( other._type == STRING)
+    if( other._type == STRING )
     {
-      const char* raw = other._storage.raw_string;
-      const uint32_t size = *(reinterpret_cast<const uint32_t*>( &raw[0] ));
-      const char* data = (&raw[4]);
-      assign( data, size );
+      assign( other.stringData(), other.stringSize() );
     }
     else{
-      _type = other._type;
-      _storage.raw_data = other._storage.raw_data;
+      copyRaw( other );
     }
   }
 
-  Variant(Variant&& other): _type(OTHER)
+  Variant(Variant&& other)
+  {
+    copyRaw( other );
+    other._type = OTHER;
+  }
+
+  Variant& operator = (const Variant& other)
   {
-    if( other._type == STRING)
+    if( this == &other )
     {
-      _storage.raw_string = nullptr;
-      std::swap( _storage.raw_string,  other._storage.raw_string);
-      std::swap( _type, other._type);
+      return *this;
+    }
+    if( other._type == STRING )
+    {
+      assign( other.stringData(), other.stringSize() );
     }
     else{
-      _type = other._type;
-      _storage.raw_data = other._storage.raw_data;
+      clearStringIfNecessary();
+      copyRaw( other );
     }
+    return *this;
   }
 
-  Variant& operator = (const Variant& other)
+  Variant& operator = (Variant&& other)
   {
-    if( other._type == STRING)
+    if( this != &other )
     {
-      const char* raw = other._storage.raw_string;
-      const uint32_t size = *(reinterpret_cast<const uint32_t*>( &raw[0] ));
-      const char* data = (&raw[4]);
-      assign( data, size );
-    }
-    else{
-      _type = other._type;
-      _storage.raw_data = other._storage.raw_data;
+      clearStringIfNecessary();
+      copyRaw( other );
+      other._type = OTHER;
     }
     return *this;
   }
@@ -116,27 +122,94 @@ public:
 
   template <typename T> void assign(const T& value);
 
+  /// Strings shorter than INLINE_STRING_CAPACITY are stored inside the Variant itself.
+  /// The memory of a longer string is reused if the new one fits in it.
   void assign(const char* buffer, size_t length);
 
+  /// Copy the raw memory of a builtin type which is NOT a string.
+  /// No check is done: [data] must contain at least builtinSize(type) bytes.
+  void assignRaw(BuiltinType type, const uint8_t* data, size_t size);
+
+  static const size_t INLINE_STRING_CAPACITY = 13;
+
 private:
 
-  union {
-    std::array<uint8_t,8> raw_data;
-    char* raw_string;
-  }_storage;
+  enum StringStorage: uint8_t {
+    HEAP_STRING,     // owned by the Variant: [uint32 size][uint32 capacity][data]['\0']
+    INLINE_STRING    // inside _raw, the size is stored in the last byte
+  };
+
+  // Builtins are stored in the first 8 bytes. Strings use either a pointer (first 8 bytes)
+  // or all of them (INLINE_STRING).
+  alignas(8) uint8_t _raw[INLINE_STRING_CAPACITY + 1];
+  StringStorage _string_storage;
+  uint8_t _type;
+
+  char* rawString() const
+  {
+    char* ptr;
+    std::memcpy( &ptr, _raw, sizeof(ptr) );
+    return ptr;
+  }
+
+  void setRawString(char* ptr)
+  {
+    std::memcpy( _raw, &ptr, sizeof(ptr) );
+  }
+
+  const char* stringData() const
+  {
+    return (_string_storage == INLINE_STRING) ?
+          reinterpret_cast<const char*>( _raw ) : rawString() + 8;
+  }
+
+  uint32_t stringSize() const
+  {
+    if( _string_storage == INLINE_STRING )
+    {
+      return _raw[INLINE_STRING_CAPACITY];
+    }
+    return *reinterpret_cast<const uint32_t*>( rawString() );
+  }
+
+  void copyRaw(const Variant& other)
+  {
+    std::memcpy( _raw, other._raw, sizeof(_raw) );
+    _string_storage = other._string_storage;
+    _type = other._type;
+  }
 
   void clearStringIfNecessary();
 
-  BuiltinType _type;
+  template <class VariantAt>
+  friend size_t details::ConvertVariantsToDouble(VariantAt variantAt, size_t count,
+                                                 double* output, uint64_t* failed);
 };
 
+/**
+ * @brief Convert many Variant(s) to double at once.
+ *
+ * Consecutive values with the same type are converted by a single loop,
+ * without the per-value dispatch of Variant::convert<double>().
+ * Errors don't throw: the output is set to NaN and the bit of the value is set in [failed].
+ * Strings and 64 bits integers that a double can't represent exactly are errors.
+ *
+ * @param values  array of [count] Variant(s).
+ * @param count   number of Variant(s).
+ * @param output  array of [count] elements.
+ * @param failed  array of (count+63)/64 elements, overwritten. Bit i%64 of failed[i/64] refers to value i.
+ * @return        number of values that could not be converted.
+ */
+size_t ConvertToDouble(const Variant* values, size_t count,
+                       double* output, uint64_t* failed);
+
+static_assert( sizeof(Variant) == 16, "Variant is expected to use 16 bytes" );
 
 //----------------------- Implementation ----------------------------------------------
 
-
 template<typename T>
 inline Variant::Variant(const T& value):
-  _type(OTHER)
+  _string_storage(HEAP_STRING), _type(OTHER)
 {
   static_assert (std::numeric_limits<T>::is_specialized ||
                  std::is_same<T, ros::Time>::value ||
@@ -145,13 +218,14 @@ inline Variant::Variant(const T& value):
                  std::is_same<T, ros::Duration>::value
                  , "not a valid type");
 
-  _storage.raw_string = (nullptr);
+  setRawString(nullptr);
   assign(value);
 }
 
-inline Variant::Variant(const char* buffer, size_t length):_type(OTHER)
+inline Variant::Variant(const char* buffer, size_t length):
+  _string_storage(HEAP_STRING), _type(OTHER)
 {
-  _storage.raw_string = (nullptr);
+  setRawString(nullptr);
   assign(buffer,length);
 }
 
@@ -163,7 +237,7 @@ inline Variant::~Variant()
 //-------------------------------------
 
 inline BuiltinType Variant::getTypeID() const {
-  return _type;
+  return static_cast<BuiltinType>(_type);
 }
 
 template<typename T> inline T Variant::extract( ) const
@@ -177,7 +251,7 @@ template<typename T> inline T Variant::extract( ) const
   {
     throw TypeException("Variant::extract -> wrong type");
   }
-  return * reinterpret_cast<const T*>( &_storage.raw_data[0] );
+  return * reinterpret_cast<const T*>( &_raw[0] );
 }
 
 template<> inline boost::string_ref Variant::extract( ) const
@@ -187,9 +261,7 @@ template<> inline boost::string_ref Variant::extract( ) const
   {
     throw TypeException("Variant::extract -> wrong type");
   }
-  const uint32_t size = *(reinterpret_cast<const uint32_t*>( &_storage.raw_string[0] ));
-  char* data = static_cast<char*>(&_storage.raw_string[4]);
-  return boost::string_ref(data, size);
+  return boost::string_ref( stringData(), stringSize() );
 }
 
 template<> inline std::string Variant::extract( ) const
@@ -198,9 +270,7 @@ template<> inline std::string Variant::extract( ) const
   {
     throw TypeException("Variant::extract -> wrong type");
   }
-  const uint32_t size = *(reinterpret_cast<const uint32_t*>( &_storage.raw_string[0] ));
-  char* data = static_cast<char*>(&_storage.raw_string[4]);
-  return std::string(data, size);
+  return std::string( stringData(), stringSize() );
 }
 
 //-------------------------------------
@@ -214,30 +284,60 @@ template <typename T> inline void Variant::assign(const T& value)
 
   clearStringIfNecessary();
   _type = RosIntrospection::getType<T>() ;
-  *reinterpret_cast<T *>( &_storage.raw_data[0] ) =  value;
+  *reinterpret_cast<T *>( &_raw[0] ) =  value;
 }
 
 inline void Variant::clearStringIfNecessary()
 {
-  if( _storage.raw_string && _type == STRING)
+  if( _type == STRING && _string_storage == HEAP_STRING )
   {
-    delete [] _storage.raw_string;
-    _storage.raw_string = nullptr;
+    delete [] rawString();
+    setRawString(nullptr);
   }
+  _string_storage = HEAP_STRING;
 }
 
 inline void Variant::assign(const char* buffer, size_t size)
 {
+  if( _type == STRING && _string_storage == HEAP_STRING && size > INLINE_STRING_CAPACITY )
+  {
+    // reuse the memory already allocated
+    char* raw = rawString();
+    const uint32_t capacity = *reinterpret_cast<const uint32_t*>( &raw[4] );
+    if( size <= capacity )
+    {
+      *reinterpret_cast<uint32_t *>( &raw[0] ) = size;
+      std::memmove( &raw[8], buffer, size );
+      raw[size+8] = '\0';
+      return;
+    }
+  }
+
   clearStringIfNecessary();
   _type = STRING;
 
-  _storage.raw_string = new char[size+5];
-  *reinterpret_cast<uint32_t *>( &_storage.raw_string[0] ) = size;
-  memcpy(&_storage.raw_string[4] , buffer, size );
-  _storage.raw_string[size+4] = '\0';
-}
+  if( size <= INLINE_STRING_CAPACITY )
+  {
+    _string_storage = INLINE_STRING;
+    std::memmove( _raw, buffer, size );
+    _raw[INLINE_STRING_CAPACITY] = static_cast<uint8_t>(size);
+    return;
+  }
 
+  char* raw = new char[size+9];
+  *reinterpret_cast<uint32_t *>( &raw[0] ) = size;
+  *reinterpret_cast<uint32_t *>( &raw[4] ) = size;
+  std::memcpy( &raw[8], buffer, size );
+  raw[size+8] = '\0';
+  setRawString( raw );
+}
 
+inline void Variant::assignRaw(BuiltinType type, const uint8_t* data, size_t size)
+{
+  clearStringIfNecessary();
+  _type = type;
+  std::memcpy( &_raw[0], data, size );
+}
 
 template <> inline void Variant::assign(const boost::string_ref& value)
 {
@@ -261,7 +361,7 @@ template<typename DST> inline DST Variant::convert() const
   using namespace RosIntrospection::details;
   DST target;
 
-  const auto& raw_data = &_storage.raw_data[0];
+  const auto& raw_data = &_raw[0];
   //----------
   switch( _type )
   {
@@ -298,11 +398,160 @@ template<typename DST> inline DST Variant::convert() const
   return  target;
 }
 
+//-------------------------------------
+
+namespace details{
+
+inline void SetFailedBits(uint64_t* failed, size_t first_bit, size_t count)
+{
+  for (size_t i=first_bit; i<first_bit+count; i++)
+  {
+    failed[i/64] |= uint64_t(1) << (i%64);
+  }
+}
+
+inline bool IsExactDouble(int64_t value)
+{
+  const int64_t limit = int64_t(1) << std::numeric_limits<double>::digits;
+  if( value >= -limit && value <= limit )
+  {
+    return true;
+  }
+  const double tmp = static_cast<double>(value);
+  return tmp < 9223372036854775808.0 && static_cast<int64_t>(tmp) == value;
+}
+
+inline bool IsExactDouble(uint64_t value)
+{
+  if( value <= (uint64_t(1) << std::numeric_limits<double>::digits) )
+  {
+    return true;
+  }
+  const double tmp = static_cast<double>(value);
+  return tmp < 18446744073709551616.0 && static_cast<uint64_t>(tmp) == value;
+}
+
+/// Values of type T. rawAt(i) returns the memory of the i-th one.
+template <typename T, class RawAt>
+inline size_t ConvertRunToDouble(RawAt rawAt, size_t count,
+                                 double* output, uint64_t*, size_t)
+{
+  for (size_t i=0; i<count; i++)
+  {
+    T value;
+    std::memcpy( &value, rawAt(i), sizeof(T) );
+    output[i] = static_cast<double>(value);
+  }
+  return 0;
+}
+
+template <typename T, class RawAt>
+inline size_t ConvertRunToDoubleChecked(RawAt rawAt, size_t count,
+                                        double* output, uint64_t* failed, size_t first_bit)
+{
+  size_t errors = 0;
+  for (size_t i=0; i<count; i++)
+  {
+    T value;
+    std::memcpy( &value, rawAt(i), sizeof(T) );
+    output[i] = static_cast<double>(value);
+    if( !IsExactDouble(value) )
+    {
+      output[i] = std::numeric_limits<double>::quiet_NaN();
+      SetFailedBits( failed, first_bit + i, 1 );
+      errors++;
+    }
+  }
+  return errors;
+}
+
+/// Both ros::Time and ros::Duration are converted to seconds.
+template <typename T, class RawAt>
+inline size_t ConvertRunToSeconds(RawAt rawAt, size_t count,
+                                  double* output, uint64_t*, size_t)
+{
+  for (size_t i=0; i<count; i++)
+  {
+    T sec_nsec[2];
+    std::memcpy( sec_nsec, rawAt(i), sizeof(sec_nsec) );
+    output[i] = static_cast<double>(sec_nsec[0]) + 1e-9 * static_cast<double>(sec_nsec[1]);
+  }
+  return 0;
+}
+
+/// [count] values of the same [type]; rawAt(i) returns the memory of the i-th one.
+/// Bit [first_bit] of [failed] refers to the first value.
+template <class RawAt>
+inline size_t ConvertRunToDouble(BuiltinType type, RawAt rawAt, size_t count,
+                                 double* output, uint64_t* failed, size_t first_bit)
+{
+  switch( type )
+  {
+  case CHAR:
+  case INT8:  return ConvertRunToDouble<int8_t> ( rawAt, count, output, failed, first_bit );
+  case INT16: return ConvertRunToDouble<int16_t>( rawAt, count, output, failed, first_bit );
+  case INT32: return ConvertRunToDouble<int32_t>( rawAt, count, output, failed, first_bit );
+  case INT64: return ConvertRunToDoubleChecked<int64_t>( rawAt, count, output, failed, first_bit );
+
+  case BOOL:
+  case BYTE:
+  case UINT8:  return ConvertRunToDouble<uint8_t> ( rawAt, count, output, failed, first_bit );
+  case UINT16: return ConvertRunToDouble<uint16_t>( rawAt, count, output, failed, first_bit );
+  case UINT32: return ConvertRunToDouble<uint32_t>( rawAt, count, output, failed, first_bit );
+  case UINT64: return ConvertRunToDoubleChecked<uint64_t>( rawAt, count, output, failed, first_bit );
+
+  case FLOAT32: return ConvertRunToDouble<float> ( rawAt, count, output, failed, first_bit );
+  case FLOAT64: return ConvertRunToDouble<double>( rawAt, count, output, failed, first_bit );
+
+  case TIME:     return ConvertRunToSeconds<uint32_t>( rawAt, count, output, failed, first_bit );
+  case DURATION: return ConvertRunToSeconds<int32_t> ( rawAt, count, output, failed, first_bit );
+
+  default: break;
+  }
+  std::fill( output, output + count, std::numeric_limits<double>::quiet_NaN() );
+  SetFailedBits( failed, first_bit, count );
+  return count;
+}
+
+/// Same as ConvertToDouble(const Variant*, ...), where variantAt(i) returns the i-th Variant.
+template <class VariantAt>
+inline size_t ConvertVariantsToDouble(VariantAt variantAt, size_t count,
+                                      double* output, uint64_t* failed)
+{
+  std::fill( failed, failed + (count+63)/64, 0 );
+
+  size_t errors = 0;
+  size_t i = 0;
+  while( i < count )
+  {
+    const uint8_t type = variantAt(i)._type;
+    size_t run_end = i+1;
+    while( run_end < count && variantAt(run_end)._type == type )
+    {
+      run_end++;
+    }
+    const auto rawAt = [&](size_t k) -> const uint8_t* { return variantAt(i+k)._raw; };
+    errors += ConvertRunToDouble( static_cast<BuiltinType>(type), rawAt,
+                                  run_end - i, output + i, failed, i );
+    i = run_end;
+  }
+  return errors;
+}
+
+} // end namespace details
+
+inline size_t ConvertToDouble(const Variant* values, size_t count,
+                              double* output, uint64_t* failed)
+{
+  return details::ConvertVariantsToDouble( [values](size_t i) -> const Variant& { return values[i]; },
+                                           count, output, failed );
+}
+
 template<> inline double Variant::convert() const
 {
   using namespace RosIntrospection::details;
   double target = 0;
-  const auto& raw_data = &_storage.raw_data[0];
+  const auto& raw_data = &_raw[0];
   //----------
   switch( _type )
   {
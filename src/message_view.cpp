@@ -0,0 +1,337 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright 2016-2017 Davide Faconti
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+* *******************************************************************/
+
+
+#include <limits>
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include "ros_type_introspection/message_view.hpp"
+
+namespace RosIntrospection{
+
+MessageView::MessageView(const ROSMessageInfo& info, Span<uint8_t> buffer):
+  _info(info), _buffer(buffer)
+{
+}
+
+void MessageView::reset(Span<uint8_t> buffer)
+{
+  _buffer = buffer;
+  _offsets.clear();
+}
+
+StringTreeLeaf MessageView::leaf(const std::string& path) const
+{
+  StringTreeLeaf out;
+  const StringTreeNode* node = _info.string_tree.croot();
+
+  std::vector<std::string> names;
+  boost::split( names, path, boost::is_any_of("/.") );
+
+  for (const std::string& name: names)
+  {
+    if( name.empty() ) continue;
+
+    if( node->children().size() == 1 && node->child(0)->value() == "#" )
+    {
+      char* end = nullptr;
+      const long index = std::strtol( name.c_str(), &end, 10 );
+      if( *end != '\0' || index < 0 || index > std::numeric_limits<uint16_t>::max() ||
+          out.index_array.size() == out.index_array.capacity() )
+      {
+        throw std::runtime_error("MessageView: invalid array index in path: " + path );
+      }
+      out.index_array.push_back( static_cast<uint16_t>(index) );
+      node = node->child(0);
+      continue;
+    }
+
+    node = _info.string_tree.findChild( node, name );
+    if( !node )
+    {
+      throw std::runtime_error("MessageView: path not found: " + path );
+    }
+  }
+  out.node_ptr = node;
+  return out;
+}
+
+Variant MessageView::value(const StringTreeLeaf& leaf)
+{
+  const Location loc = locate( leaf );
+  if( !loc.field || loc.msg_node || (loc.field->isArray() && !loc.is_element) )
+  {
+    throw std::runtime_error("MessageView: the leaf is not a builtin value");
+  }
+  size_t offset = loc.offset;
+  return ReadFromBufferToVariant( loc.field->type().typeID(), _buffer, offset );
+}
+
+int32_t MessageView::arraySize(const StringTreeLeaf& leaf)
+{
+  const Location loc = locate( leaf );
+  if( !loc.field || !loc.field->isArray() || loc.is_element )
+  {
+    throw std::runtime_error("MessageView: the leaf is not an array");
+  }
+  int32_t array_size = loc.field->arraySize();
+  if( array_size == -1 )
+  {
+    size_t offset = loc.offset;
+    ReadFromBuffer( _buffer, offset, array_size );
+  }
+  return std::max( array_size, 0 );
+}
+
+MessageView::Location MessageView::locate(const StringTreeLeaf& leaf)
+{
+  const StringTreeNode* root = _info.string_tree.croot();
+
+  boost::container::small_vector<const StringTreeNode*, 16> path;
+  const StringTreeNode* node = leaf.node_ptr;
+  while( node && node != root )
+  {
+    path.push_back( node );
+    node = node->parent();
+  }
+  if( node != root )
+  {
+    throw std::runtime_error("MessageView: the leaf doesn't belong to this message");
+  }
+  std::reverse( path.begin(), path.end() );
+
+  Location loc = { 0, nullptr, nullptr, false };
+  LeafKey key;
+  const MessageTreeNode* msg_node = _info.message_tree.croot();
+  size_t offset = 0;
+
+  for (size_t i=0; i < path.size(); i++)
+  {
+    const ROSField* field = nullptr;
+    const MessageTreeNode* field_msg = nullptr;
+
+    offset = fieldOffset( msg_node, offset, path[i], key, &field, &field_msg );
+    loc = { offset, field, field_msg, false };
+
+    if( field->isArray() && i+1 < path.size() )
+    {
+      i++; // path[i] is "#"
+      const size_t depth = key.index_array.size();
+      if( depth >= leaf.index_array.size() )
+      {
+        throw std::runtime_error("MessageView: the index_array of the leaf is too short");
+      }
+      const uint16_t index = leaf.index_array[depth];
+      key.node_index = path[i]->index();
+      offset = elementOffset( *field, field_msg, offset, index, key );
+      key.index_array.push_back( index );
+      loc = { offset, field, field_msg, true };
+    }
+    msg_node = field_msg;
+  }
+  return loc;
+}
+
+size_t MessageView::fieldOffset(const MessageTreeNode* msg_node, size_t offset,
+                                const StringTreeNode* field_node, LeafKey& key,
+                                const ROSField** field_out, const MessageTreeNode** field_msg_out)
+{
+  const StringTreeNode* string_parent = field_node->parent();
+  const ROSField* prev_field = nullptr;
+  const MessageTreeNode* prev_msg = nullptr;
+  bool variable = false; // true after the first field that doesn't have a fixed size
+  size_t index_s = 0;
+  size_t index_m = 0;
+
+  for (const ROSField& field : msg_node->value()->fields() )
+  {
+    if(field.isConstant() ) continue;
+
+    const StringTreeNode* node = string_parent->child(index_s++);
+    const MessageTreeNode* child = field.type().isBuiltin() ? nullptr : msg_node->child(index_m++);
+
+    if( prev_field )
+    {
+      variable = variable || prev_field->arraySize() == -1 || elementSize( *prev_field, prev_msg ) < 0;
+      if( variable )
+      {
+        key.node_index = node->index();
+        auto it = _offsets.find( key );
+        if( it != _offsets.end() )
+        {
+          offset = it->second;
+        }
+        else{
+          offset = skipField( *prev_field, prev_msg, offset );
+          _offsets.insert( std::make_pair(key, offset) );
+        }
+      }
+      else{
+        offset = skipField( *prev_field, prev_msg, offset );
+      }
+    }
+
+    if( node == field_node )
+    {
+      *field_out = &field;
+      *field_msg_out = child;
+      return offset;
+    }
+    prev_field = &field;
+    prev_msg = child;
+  }
+  throw std::runtime_error("MessageView: field not found");
+}
+
+size_t MessageView::elementOffset(const ROSField& field, const MessageTreeNode* field_msg,
+                                  size_t offset, uint16_t index, LeafKey& key)
+{
+  int32_t array_size = field.arraySize();
+  if( array_size == -1 )
+  {
+    ReadFromBuffer( _buffer, offset, array_size );
+  }
+  if( index >= array_size )
+  {
+    throw std::runtime_error("MessageView: array index out of range");
+  }
+
+  const int32_t elem_size = elementSize( field, field_msg );
+  if( elem_size >= 0 )
+  {
+    return offset + static_cast<size_t>(elem_size) * index;
+  }
+  if( index == 0 )
+  {
+    return offset;
+  }
+
+  // elements with variable size: memoize the offset of each of them
+  key.index_array.push_back( index );
+  auto it = _offsets.find( key );
+  if( it != _offsets.end() )
+  {
+    key.index_array.pop_back();
+    return it->second;
+  }
+
+  for (uint16_t i=1; i <= index; i++)
+  {
+    key.index_array.back() = i;
+    it = _offsets.find( key );
+    if( it != _offsets.end() )
+    {
+      offset = it->second;
+    }
+    else{
+      offset = skipElement( field, field_msg, offset );
+      _offsets.insert( std::make_pair(key, offset) );
+    }
+  }
+  key.index_array.pop_back();
+  return offset;
+}
+
+int32_t MessageView::elementSize(const ROSField& field, const MessageTreeNode* field_msg) const
+{
+  if( field_msg )
+  {
+    return _info.message_size[ field_msg->index() ];
+  }
+  const BuiltinType type = field.type().typeID();
+  return (type == STRING) ? -1 : builtinSize( type );
+}
+
+size_t MessageView::skipElement(const ROSField& field, const MessageTreeNode* field_msg, size_t offset) const
+{
+  if( field_msg )
+  {
+    const int32_t msg_size = _info.message_size[ field_msg->index() ];
+    return (msg_size >= 0) ? offset + msg_size : skipMessage( field_msg, offset );
+  }
+  if( field.type().typeID() == STRING )
+  {
+    uint32_t string_size = 0;
+    ReadFromBuffer( _buffer, offset, string_size );
+    return offset + string_size;
+  }
+  return offset + builtinSize( field.type().typeID() );
+}
+
+size_t MessageView::skipField(const ROSField& field, const MessageTreeNode* field_msg, size_t offset) const
+{
+  int32_t array_size = field.arraySize();
+  if( array_size == -1 )
+  {
+    ReadFromBuffer( _buffer, offset, array_size );
+  }
+  // as in deserializeIntoFlatContainer, a negative length is an empty array
+  if( array_size < 0 )
+  {
+    array_size = 0;
+  }
+
+  const int32_t elem_size = elementSize( field, field_msg );
+  if( elem_size >= 0 )
+  {
+    offset += static_cast<size_t>(elem_size) * array_size;
+  }
+  else{
+    for (int32_t i=0; i < array_size; i++)
+    {
+      offset = skipElement( field, field_msg, offset );
+    }
+  }
+
+  if( offset > _buffer.size() )
+  {
+    throw std::runtime_error("Buffer overrun in MessageView");
+  }
+  return offset;
+}
+
+size_t MessageView::skipMessage(const MessageTreeNode* msg_node, size_t offset) const
+{
+  size_t index_m = 0;
+  for (const ROSField& field : msg_node->value()->fields() )
+  {
+    if(field.isConstant() ) continue;
+
+    const MessageTreeNode* child = field.type().isBuiltin() ? nullptr : msg_node->child(index_m++);
+    offset = skipField( field, child, offset );
+  }
+  return offset;
+}
+
+}
@@ -33,103 +33,114 @@
 * *******************************************************************/
 
 #include "ros_type_introspection/ros_field.hpp"
-#include <boost/regex.hpp>
-#include <boost/algorithm/string/regex.hpp>
-#include <boost/algorithm/string/trim.hpp>
+#include <cstdlib>
+#include <stdexcept>
 
 namespace RosIntrospection{
 
-ROSField::ROSField(const std::string &definition):
-  _array_size(1)
-{
-  static const  boost::regex type_regex("[a-zA-Z][a-zA-Z0-9_]*"
-                                        "(/[a-zA-Z][a-zA-Z0-9_]*){0,1}"
-                                        "(\\[[0-9]*\\]){0,1}");
-
-  static const  boost::regex field_regex("[a-zA-Z][a-zA-Z0-9_]*");
+// Character classes of the .msg grammar ("C" locale).
+static inline bool isSpace(char c)  { return c == ' ' || ( c >= '\t' && c <= '\r' ); }
+static inline bool isLetter(char c) { return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ); }
+static inline bool isDigit(char c)  { return c >= '0' && c <= '9'; }
+static inline bool isIdentifier(char c) { return isLetter(c) || isDigit(c) || c == '_'; }
 
-  static const boost::regex array_regex("(.+)(\\[([0-9]*)\\])");
+template <typename Predicate>
+static inline size_t SkipWhile(const std::string& str, size_t pos, Predicate predicate)
+{
+  while( pos < str.size() && predicate( str[pos] ) ) { pos++; }
+  return pos;
+}
 
-  using boost::regex;
-  std::string::const_iterator begin = definition.begin();
-  std::string::const_iterator end   = definition.end();
-  boost::match_results<std::string::const_iterator> what;
+template <typename Predicate>
+static inline size_t SkipUntil(const std::string& str, size_t pos, Predicate predicate)
+{
+  while( pos < str.size() && !predicate( str[pos] ) ) { pos++; }
+  return pos;
+}
 
-  // Get type and field
-  std::string type, value;
+ROSField::ROSField(const std::string &definition):
+  _array_size(1)
+{
+  // Grammar of a field (anything before the type and between type and name is ignored):
+  //
+  //   type  := identifier [ "/" identifier ] [ "[" digits "]" ]
+  //   field := type identifier [ "=" constant | "#" comment ]
+  //
+  // where identifier is [a-zA-Z][a-zA-Z0-9_]*
 
   //-------------------------------
   // Find type, field and array size
-  if( regex_search(begin, end, what, type_regex)) {
-    type = what[0];
-    begin = what[0].second;
-  }
-  else {
+  const size_t type_begin = SkipUntil( definition, 0, isLetter );
+  if( type_begin == definition.size() )
+  {
     throw std::runtime_error("Bad type when parsing field: " + definition);
   }
+  size_t pos = SkipWhile( definition, type_begin+1, isIdentifier );
 
-  if (regex_search(begin, end, what, field_regex))
+  if( pos+1 < definition.size() && definition[pos] == '/' && isLetter( definition[pos+1] ) )
   {
-    _fieldname = what[0];
-    begin = what[0].second;
-  }
-  else {
-    throw std::runtime_error("Bad field when parsing field: " + definition);
+    pos = SkipWhile( definition, pos+2, isIdentifier );
   }
+  size_t type_end = pos;
 
-  std::string temp_type = type;
-  if (regex_search(temp_type, what, array_regex))
+  if( pos < definition.size() && definition[pos] == '[' )
   {
-    type = what[1];
-
-    if (what.size() == 3) {
-      _array_size = -1;
-    }
-    else if (what.size() == 4) {
-      std::string size(what[3].first, what[3].second);
-      _array_size = size.empty() ? -1 : atoi(size.c_str());
-    }
-    else {
-      throw std::runtime_error("Bad array size when parsing field:  " + definition);
+    const size_t digits_end = SkipWhile( definition, pos+1, isDigit );
+    if( digits_end < definition.size() && definition[digits_end] == ']' )
+    {
+      const std::string size( definition, pos+1, digits_end - (pos+1) );
+      _array_size = size.empty() ? -1 : atoi( size.c_str() );
+      pos = digits_end + 1;
     }
   }
+  const std::string type( definition, type_begin, type_end - type_begin );
+
+  const size_t name_begin = SkipUntil( definition, pos, isLetter );
+  if( name_begin == definition.size() )
+  {
+    throw std::runtime_error("Bad field when parsing field: " + definition);
+  }
+  pos = SkipWhile( definition, name_begin+1, isIdentifier );
+  _fieldname.assign( definition, name_begin, pos - name_begin );
 
   //-------------------------------
   // Find if Constant or comment
 
   // Determine next character
   // if '=' -> constant, if '#' -> done, if nothing -> done, otherwise error
-  if (regex_search(begin, end, what, boost::regex("\\S")))
+  pos = SkipWhile( definition, pos, isSpace );
+  if( pos < definition.size() )
   {
-    if (what[0] == "=")
+    if( definition[pos] == '=' )
     {
-      begin = what[0].second;
-      // Copy constant
-      if (type == "string") {
-        value.assign(begin, end);
-      }
-      else {
-        if (regex_search(begin, end, what, boost::regex("\\s*#")))
-        {
-          value.assign(begin, what[0].first);
-        }
-        else {
-          value.assign(begin, end);
-        }
-        // TODO: Raise error if string is not numeric
+      // Copy constant. A string constant contains everything until the end of the line,
+      // the other ones end at the comment.
+      size_t value_begin = pos+1;
+      size_t value_end = ( type == "string" ) ? definition.size() : definition.find( '#', value_begin );
+      if( value_end == std::string::npos )
+      {
+        value_end = definition.size();
       }
+      // TODO: Raise error if string is not numeric
 
-      boost::algorithm::trim(value);
-    } else if (what[0] == "#") {
+      value_begin = SkipWhile( definition, value_begin, isSpace );
+      while( value_end > value_begin && isSpace( definition[value_end-1] ) )
+      {
+        value_end--;
+      }
+      _value.assign( definition, value_begin, value_end - value_begin );
+    }
+    else if( definition[pos] == '#' )
+    {
       // Ignore comment
-    } else {
+    }
+    else {
       // Error
       throw std::runtime_error("Unexpected character after type and field:  " +
                                definition);
     }
   }
-  _type  = ROSType( type );
-  _value = value;
+  _type = ROSType( type );
 }
 
 }
@@ -36,8 +36,6 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/utility/string_ref.hpp>
 #include <boost/lexical_cast.hpp>
-#include <boost/regex.hpp>
-#include <boost/algorithm/string/regex.hpp>
 #include <functional>
 #include "ros_type_introspection/ros_introspection.hpp"
 #include "ros_type_introspection/helper_functions.hpp"
@@ -46,27 +44,20 @@ namespace RosIntrospection {
 
 void Parser::createTrees(ROSMessageInfo& info, const std::string &type_name) const
 {
-  std::function<void(const ROSMessage*, StringTreeNode*, MessageTreeNode* )> recursiveTreeCreator;
+  std::function<void(const ROSMessage*, uint32_t, uint32_t )> recursiveTreeCreator;
 
-  recursiveTreeCreator = [&](const ROSMessage* msg_definition, StringTreeNode* string_node, MessageTreeNode* msg_node)
+  // nodes are referred by index, that remains valid while the trees grow
+  recursiveTreeCreator = [&](const ROSMessage* msg_definition, uint32_t string_node, uint32_t msg_node)
   {
-    // note: should use reserve here, NOT resize
-    const size_t NUM_FIELDS = msg_definition->fields().size();
-
-    string_node->children().reserve( NUM_FIELDS );
-    msg_node->children().reserve( NUM_FIELDS );
-
     for (const ROSField& field : msg_definition->fields() )
     {
       if(field.isConstant() == false) {
 
         // Let's add first a child to string_node
-        string_node->addChild( field.name() );
-        StringTreeNode*  new_string_node = &(string_node->children().back());
+        uint32_t new_string_node = info.string_tree.addChild( string_node, field.name() );
         if( field.isArray())
         {
-          new_string_node->children().reserve(1);
-          new_string_node = new_string_node->addChild("#");
+          new_string_node = info.string_tree.addChild( new_string_node, "#" );
         }
 
         const ROSMessage* next_msg = nullptr;
@@ -78,8 +69,7 @@ void Parser::createTrees(ROSMessageInfo& info, const std::string &type_name) con
           {
             throw std::runtime_error("This type was not registered " );
           }
-          msg_node->addChild( next_msg );
-          MessageTreeNode* new_msg_node = &(msg_node->children().back());
+          const uint32_t new_msg_node = info.message_tree.addChild( msg_node, next_msg );
           recursiveTreeCreator(next_msg, new_string_node, new_msg_node);
         }
       } //end of field.isConstant()
@@ -90,48 +80,393 @@ void Parser::createTrees(ROSMessageInfo& info, const std::string &type_name) con
   info.message_tree.root()->setValue( &info.type_list.front() );
   //TODO info.type_tree.root()->value() =
   // start recursion
-  recursiveTreeCreator( &info.type_list.front(),
-                        info.string_tree.root(),
-                        info.message_tree.root());
+  recursiveTreeCreator( &info.type_list.front(), 0, 0 );
+
+  info.string_tree.indexNodes();
+  info.message_tree.indexNodes();
+  BuildPathTemplates( info.string_tree );
 }
 
-inline bool operator ==( const std::string& a, const boost::string_ref& b)
+// Above this number of leaves, the fixed layout would just waste memory
+static const size_t MAX_FIXED_LAYOUT_SIZE = 4096;
+
+// If the message contains neither strings nor variable-length arrays, each leaf
+// has a known offset. Execute the plan once, without a buffer, to find them.
+static void CompileFixedLayout(ROSMessageInfo& info)
 {
-  return (  a.size() == b.size() && std::strncmp( a.data(), b.data(), a.size()) == 0);
+  const std::vector<PlanInstruction>& plan = info.plan;
+
+  info.fixed_size = -1;
+  info.fixed_max_array_size = 0;
+  info.fixed_layout.clear();
+
+  for(const PlanInstruction& instr: plan)
+  {
+    if( instr.type == STRING || instr.array_size == -1 )
+    {
+      return;
+    }
+  }
+
+  struct Loop{
+    uint32_t body;
+    int32_t  index;
+    int32_t  size;
+  };
+  std::vector<Loop> loops;
+  std::vector<FixedLeaf> layout;
+  FixedLeaf leaf;
+  uint32_t offset = 0;
+  uint32_t max_array_size = 0;
+
+  auto addLeaf = [&](const PlanInstruction& instr)
+  {
+    leaf.offset = offset;
+    leaf.size   = builtinSize(instr.type);
+    leaf.type   = instr.type;
+    leaf.node   = instr.node;
+    layout.push_back( leaf );
+    offset += leaf.size;
+  };
+
+  size_t pc = 0;
+  while( pc < plan.size() )
+  {
+    if( layout.size() > MAX_FIXED_LAYOUT_SIZE )
+    {
+      return;
+    }
+    const PlanInstruction& instr = plan[pc];
+
+    switch( instr.op )
+    {
+    case PlanInstruction::READ_BUILTIN:{
+      addLeaf( instr );
+      pc++;
+    } break;
+
+    case PlanInstruction::READ_ARRAY:{
+      max_array_size = std::max( max_array_size, static_cast<uint32_t>(instr.array_size) );
+      leaf.index_array.push_back(0);
+      for (int i=0; i<instr.array_size; i++ )
+      {
+        leaf.index_array.back() = i;
+        addLeaf( instr );
+      }
+      leaf.index_array.pop_back();
+      pc++;
+    } break;
+
+    case PlanInstruction::BEGIN_LOOP:{
+      max_array_size = std::max( max_array_size, static_cast<uint32_t>(instr.array_size) );
+      if( instr.array_size == 0 )
+      {
+        pc = instr.jump;
+        break;
+      }
+      loops.push_back( { static_cast<uint32_t>(pc+1), 0, instr.array_size } );
+      leaf.index_array.push_back(0);
+      pc++;
+    } break;
+
+    case PlanInstruction::END_LOOP:{
+      Loop& loop = loops.back();
+      if( ++loop.index < loop.size )
+      {
+        leaf.index_array.back() = loop.index;
+        pc = loop.body;
+      }
+      else{
+        leaf.index_array.pop_back();
+        loops.pop_back();
+        pc++;
+      }
+    } break;
+
+    default: pc++;
+    }
+  }
+
+  info.fixed_size = offset;
+  info.fixed_max_array_size = max_array_size;
+  info.fixed_layout = std::move(layout);
 }
 
-inline bool FindPattern(const std::vector<boost::string_ref> &pattern,
-                        size_t index, const StringTreeNode *tail,
-                        const StringTreeNode **head)
+// Mark of each node of the StringTree, used by registerProjection
+enum ProjectionMark: uint8_t {
+  NOT_SELECTED = 0,
+  PARTIALLY_SELECTED, // one of the children is selected
+  SELECTED
+};
+
+// What we need to know to skip a field (or a whole message)
+struct SkipInfo{
+  int32_t  elem_size;          // -1 if the size of a single element is not fixed
+  int32_t  size;               // -1 if the total size is not fixed
+  uint32_t array_size;         // largest array among the fields
+  uint32_t nested_array_size;  // largest array inside the nested messages
+};
+
+static SkipInfo FieldSkipInfo(const ROSField& field, const MessageTreeNode* msg_node);
+
+static SkipInfo MessageSkipInfo(const MessageTreeNode* msg_node)
 {
-  if(  tail->value() == pattern[index] )
+  SkipInfo out = { 0, 0, 0, 0 };
+  size_t index_m = 0;
+
+  for (const ROSField& field : msg_node->value()->fields() )
   {
-    index++;
+    if(field.isConstant() ) continue;
+
+    const MessageTreeNode* child = field.type().isBuiltin() ? nullptr : msg_node->child(index_m++);
+    const SkipInfo field_info = FieldSkipInfo( field, child );
+
+    out.size = ( out.size < 0 || field_info.size < 0 ) ? -1 : out.size + field_info.size;
+    out.array_size = std::max( out.array_size, field_info.array_size );
+    out.nested_array_size = std::max( out.nested_array_size, field_info.nested_array_size );
   }
-  else{ // mismatch
-    if( index > 0 ){
-      // reset counter;
-      FindPattern( pattern, 0, tail, head);
-      return false;
+  out.elem_size = out.size;
+  return out;
+}
+
+static SkipInfo FieldSkipInfo(const ROSField& field, const MessageTreeNode* msg_node)
+{
+  SkipInfo out = { -1, -1, 0, 0 };
+  const int32_t array_size = field.arraySize();
+  bool is_blob = false;
+
+  if( msg_node )
+  {
+    const SkipInfo msg_info = MessageSkipInfo( msg_node );
+    if( array_size != 0 )
+    {
+      out.nested_array_size = std::max( msg_info.array_size, msg_info.nested_array_size );
+    }
+    out.elem_size = msg_info.size;
+  }
+  else if( field.type().typeID() != STRING )
+  {
+    out.elem_size = builtinSize( field.type().typeID() );
+    is_blob = ( out.elem_size == 1 );
+  }
+
+  if( field.isArray() && array_size > 0 && !is_blob )
+  {
+    out.array_size = array_size;
+  }
+  if( out.elem_size >= 0 && array_size >= 0 )
+  {
+    out.size = out.elem_size * array_size;
+  }
+  return out;
+}
+
+// Append to the plan the instructions of a message. If [selection] is not null,
+// the fields that are NOT_SELECTED are skipped.
+static void CompileMessagePlan(const MessageTreeNode* msg_node,
+                               const StringTreeNode* string_node,
+                               const std::vector<uint8_t>* selection,
+                               std::vector<PlanInstruction>& plan)
+{
+  const ROSMessage* msg_definition = msg_node->value();
+  const size_t level_begin = plan.size();
+  size_t index_s = 0;
+  size_t index_m = 0;
+
+  for (const ROSField& field : msg_definition->fields() )
+  {
+    if(field.isConstant() ) continue;
+
+    const ROSType& field_type = field.type();
+    const StringTreeNode* field_node = string_node->child(index_s++);
+    const MessageTreeNode* child_msg = field_type.isBuiltin() ? nullptr : msg_node->child(index_m++);
+
+    PlanInstruction instr;
+    // BYTE has always been stored as UINT8 (see ReadFromBufferToVariant)
+    instr.type       = (field_type.typeID() == BYTE) ? UINT8 : field_type.typeID();
+    instr.array_size = field.arraySize();
+    instr.jump       = 0;
+    instr.size       = 0;
+    instr.nested_array_size = 0;
+    instr.node       = field.isArray() ? field_node->child(0) : field_node;
+
+    const uint8_t mark = selection ? (*selection)[ field_node->index() ] : static_cast<uint8_t>(SELECTED);
+
+    if( mark == NOT_SELECTED )
+    {
+      const SkipInfo skip = FieldSkipInfo( field, child_msg );
+      if( skip.size >= 0 )
+      {
+        // consecutive fields of the same message are skipped at once
+        if( plan.size() > level_begin && plan.back().op == PlanInstruction::SKIP_BYTES )
+        {
+          PlanInstruction& prev = plan.back();
+          prev.size += skip.size;
+          prev.array_size = std::max( prev.array_size, static_cast<int32_t>(skip.array_size) );
+          prev.nested_array_size = std::max( prev.nested_array_size, skip.nested_array_size );
+        }
+        else{
+          instr.op = PlanInstruction::SKIP_BYTES;
+          instr.size = skip.size;
+          instr.array_size = skip.array_size;
+          instr.nested_array_size = skip.nested_array_size;
+          plan.push_back( instr );
+        }
+        continue;
+      }
+      if( field_type.typeID() == STRING )
+      {
+        instr.op = PlanInstruction::SKIP_STRING;
+        plan.push_back( instr );
+        continue;
+      }
+      if( skip.elem_size >= 0 )
+      {
+        instr.op = PlanInstruction::SKIP_ARRAY;
+        instr.size = skip.elem_size;
+        instr.nested_array_size = skip.nested_array_size;
+        plan.push_back( instr );
+        continue;
+      }
+      // Nested messages without a fixed size must be visited anyway.
+    }
+
+    if( field_type.isBuiltin() )
+    {
+      if( field.isArray() ){
+        instr.op = PlanInstruction::READ_ARRAY;
+      }
+      else if( field_type.typeID() == STRING ){
+        instr.op = PlanInstruction::READ_STRING;
+      }
+      else{
+        instr.op = PlanInstruction::READ_BUILTIN;
+      }
+      plan.push_back( instr );
+    }
+    else{
+      // nested messages are inlined between a pair of opening/closing instructions
+      const size_t begin_index = plan.size();
+      instr.op = field.isArray() ? PlanInstruction::BEGIN_LOOP : PlanInstruction::DESCEND;
+      instr.size = std::max( 0, MessageSkipInfo( child_msg ).size );
+      plan.push_back( instr );
+
+      CompileMessagePlan( child_msg, instr.node,
+                          (mark == SELECTED) ? nullptr : selection, plan );
+
+      instr.op   = field.isArray() ? PlanInstruction::END_LOOP : PlanInstruction::ASCEND;
+      instr.jump = begin_index + 1;
+      plan.push_back( instr );
+      plan[begin_index].jump = plan.size();
     }
-    index = 0;
+  } // end of for fields
+}
+
+void Parser::compilePlan(ROSMessageInfo& info) const
+{
+  info.plan.clear();
+  CompileMessagePlan( info.message_tree.croot(), info.string_tree.croot(), nullptr, info.plan );
+  CompileFixedLayout( info );
+
+  info.message_size.resize( info.message_tree.size() );
+  for (size_t i=0; i < info.message_tree.size(); i++)
+  {
+    info.message_size[i] = MessageSkipInfo( info.message_tree.node(i) ).size;
   }
+}
+
+void Parser::registerProjection(const std::string& msg_identifier,
+                                const std::vector<std::string>& paths)
+{
+  auto it = _registered_messages.find(msg_identifier);
+  if( it == _registered_messages.end() )
+  {
+    throw std::runtime_error("registerProjection: msg_identifier not registered. Use registerMessageDefinition" );
+  }
+  ROSMessageInfo& info = it->second;
+  std::vector<uint8_t> selection( info.string_tree.size(), NOT_SELECTED );
+
+  std::function<void(const StringTreeNode*)> selectSubtree = [&](const StringTreeNode* node)
+  {
+    selection[ node->index() ] = SELECTED;
+    for (const auto& child: node->children() )
+    {
+      selectSubtree( &child );
+    }
+  };
+
+  std::vector<std::string> names;
+  for (const std::string& path: paths)
+  {
+    boost::split( names, path, boost::is_any_of("/") );
+    const StringTreeNode* node = info.string_tree.croot();
+
+    for (const std::string& name: names)
+    {
+      if( name.empty() ) continue;
+      // "#" is implicit
+      if( node->children().size() == 1 && node->child(0)->value() == "#" )
+      {
+        node = node->child(0);
+      }
+      node = info.string_tree.findChild( node, name );
+      if( !node )
+      {
+        throw std::runtime_error("registerProjection: path not found: " + path );
+      }
+    }
 
-  if( index == pattern.size()){
-    *head = ( tail );
-    return true;
+    selectSubtree( node );
+    for( node = node->parent(); node; node = node->parent() )
+    {
+      uint8_t& mark = selection[ node->index() ];
+      mark = std::max( mark, static_cast<uint8_t>(PARTIALLY_SELECTED) );
+    }
   }
 
-  bool found = false;
+  info.projected_plan.clear();
+  CompileMessagePlan( info.message_tree.croot(), info.string_tree.croot(),
+                      &selection, info.projected_plan );
 
-  for (auto& child: tail->children() ) {
+  info.projected_layout.clear();
+  for (const FixedLeaf& leaf: info.fixed_layout)
+  {
+    if( selection[ leaf.node->index() ] == SELECTED )
+    {
+      info.projected_layout.push_back( leaf );
+    }
+  }
+  info.has_projection = true;
+  info.plan_version++;
+}
 
-    found = FindPattern( pattern, index, &child, head);
-    if( found) break;
+void Parser::removeProjection(const std::string& msg_identifier)
+{
+  auto it = _registered_messages.find(msg_identifier);
+  if( it != _registered_messages.end() )
+  {
+    ROSMessageInfo& info = it->second;
+    info.has_projection = false;
+    info.plan_version++;
+    info.projected_plan.clear();
+    info.projected_layout.clear();
   }
-  return found;
 }
 
+inline bool operator ==( const std::string& a, const boost::string_ref& b)
+{
+  return (  a.size() == b.size() && std::strncmp( a.data(), b.data(), a.size()) == 0);
+}
+
+inline bool isNumberPlaceholder( const boost::string_ref& s)
+{
+  return s.size() == 1 && s[0] == '#';
+}
+
+inline bool isSubstitutionPlaceholder( const boost::string_ref& s)
+{
+  return s.size() == 1 && s[0] == '@';
+}
 
 void Parser::registerRenamingRules(const ROSType &type, const std::vector<SubstitutionRule> &given_rules)
 {
@@ -155,31 +490,263 @@ void Parser::updateRuleCache()
   else{
     _rule_cache_dirty = false;
   }
-  for(const auto& rule_it: _registered_rules )
+  for(const auto& msg_it: _registered_messages)
+  {
+    const std::string& msg_identifier = msg_it.first;
+    const ROSMessageInfo& msg_info    = msg_it.second;
+
+    // the rules already in the cache keep their position, the new ones are appended.
+    std::vector<RulesCache> candidates;
+    auto cache_it = _transform_caches.find( msg_identifier );
+    if( cache_it != _transform_caches.end() )
+    {
+      candidates = std::move( cache_it->second.rules );
+    }
+    for(const auto& rule_it: _registered_rules )
+    {
+      if( !getMessageByType( rule_it.first, msg_info ) )
+      {
+        continue;
+      }
+      for(const auto& rule: rule_it.second )
+      {
+        RulesCache cache(rule);
+        if( std::find( candidates.begin(), candidates.end(), cache) == candidates.end() )
+        {
+          candidates.push_back( std::move(cache) );
+        }
+      }
+    }
+    if( candidates.empty() )
+    {
+      continue;
+    }
+
+    // A single visit of the tree finds all the occurrences of all the patterns and aliases.
+    // The pattern of the r-th candidate has id 2*r, its alias 2*r+1.
+    PatternTrie trie;
+    for(const RulesCache& cache: candidates )
+    {
+      trie.addPattern( cache.rule->pattern() );
+      trie.addPattern( cache.rule->alias() );
+    }
+    std::vector< std::vector<uint32_t> > heads = trie.match( msg_info.string_tree );
+
+    std::vector<RulesCache>& cache_vector = _transform_caches[msg_identifier].rules;
+    cache_vector.clear();
+    for(size_t r=0; r < candidates.size(); r++)
+    {
+      RulesCache& cache = candidates[r];
+      cache.pattern_heads.swap( heads[2*r] );
+      cache.alias_heads.swap( heads[2*r+1] );
+      if( !cache.pattern_heads.empty() && !cache.alias_heads.empty() )
+      {
+        cache_vector.push_back( std::move(cache) );
+      }
+    }
+  }
+
+  for(auto& it: _transform_caches)
+  {
+    auto msg_it = _registered_messages.find( it.first );
+    if( msg_it != _registered_messages.end() )
+    {
+      compileRenameTemplates( msg_it->second.string_tree, it.second );
+    }
+  }
+}
+
+void Parser::compileRenameTemplates(const StringTree& tree, TransformCache& cache)
+{
+  // number of "#" in the path of each node, the node included, and depth of the node.
+  // Parents precede their children (see Tree::indexNodes).
+  std::vector<int> placeholders_count( tree.size(), 0 );
+  std::vector<uint32_t> depth( tree.size(), 0 );
+  for(uint32_t i=0; i < tree.size(); i++)
+  {
+    const StringTreeNode* node = tree.node(i);
+    const int count = node->parent() ? placeholders_count[ node->parent()->index() ] : 0;
+    placeholders_count[i] = count + ( isNumberPlaceholder( node->value() ) ? 1 : 0 );
+    depth[i] = node->parent() ? depth[ node->parent()->index() ] + 1 : 0;
+  }
+
+  cache.templates.clear();
+  cache.templates.resize( tree.size() );
+  cache.fingerprint.clear();
+  cache.alias_table_count = 0;
+
+  std::vector<const StringTreeNode*> stack;
+  std::vector<RenameToken> reversed;
+  std::vector<bool> is_ancestor( tree.size(), false );
+  std::vector< std::pair<uint32_t,uint32_t> > candidates; // depth of the common ancestor, alias
+
+  for(uint32_t r=0; r < cache.rules.size(); r++)
   {
-    const ROSType& type = rule_it.first;
-    const std::unordered_set<SubstitutionRule>& rule_set = rule_it.second;
+    RulesCache& rule_cache = cache.rules[r];
+    const SubstitutionRule& rule = *rule_cache.rule;
+
+    // The heads are sorted, parents first: when an occurrence of the alias (or of the pattern)
+    // contains another one, the outermost wins.
+    const size_t alias_count = rule_cache.alias_heads.size();
+    rule_cache.first_table = cache.alias_table_count;
+    cache.alias_table_count += alias_count;
+    rule_cache.alias_pos.assign( alias_count, -1 );
+    rule_cache.alias_of_node.assign( tree.size(), -1 );
+    for (size_t a=0; a < alias_count; a++)
+    {
+      const uint32_t alias_head = rule_cache.alias_heads[a];
+      if( rule_cache.alias_of_node[alias_head] >= 0 )
+      {
+        continue;
+      }
+      rule_cache.alias_pos[a] = static_cast<int16_t>( placeholders_count[ alias_head ] - 1 );
+      stack.assign( 1, tree.node(alias_head) );
+      while( !stack.empty() )
+      {
+        const StringTreeNode* node = stack.back();
+        stack.pop_back();
+        rule_cache.alias_of_node[ node->index() ] = static_cast<int32_t>( a );
+        for (const auto& child: node->children() ) { stack.push_back( &child ); }
+      }
+    }
 
-    for(const auto& msg_it: _registered_messages)
+    for (uint32_t head_index: rule_cache.pattern_heads)
     {
-      const std::string& msg_identifier = msg_it.first;
-      const ROSMessageInfo& msg_info    = msg_it.second;
+      const StringTreeNode* pattern_head = tree.node(head_index);
+      const int pattern_pos = placeholders_count[ head_index ] - 1;
+      if( pattern_pos < 0 )
+      {
+        continue; // there is no index to match: this occurrence can not be renamed
+      }
 
-      if( getMessageByType(type, msg_info) )
+      // Every occurrence of the alias is a candidate, also the ones that contain the pattern
+      // or are contained by it. When there are several, the names are taken from the first one
+      // that has any, preferring those that share a deeper ancestor with the pattern
+      // (i.e. the names of the same nested message).
+      for (const StringTreeNode* node = pattern_head; node; node = node->parent())
       {
-        std::vector<RulesCache>&  cache_vector = _rule_caches[msg_identifier];
-        for(const auto& rule: rule_set )
+        is_ancestor[ node->index() ] = true;
+      }
+      candidates.clear();
+      for (size_t a=0; a < alias_count; a++)
+      {
+        if( rule_cache.alias_pos[a] < 0 ) continue;
+
+        const StringTreeNode* node = tree.node( rule_cache.alias_heads[a] );
+        while( !is_ancestor[ node->index() ] )
+        {
+          node = node->parent();
+        }
+        candidates.push_back( std::make_pair( depth[ node->index() ], static_cast<uint32_t>(a) ) );
+      }
+      for (const StringTreeNode* node = pattern_head; node; node = node->parent())
+      {
+        is_ancestor[ node->index() ] = false;
+      }
+      if( candidates.empty() )
+      {
+        continue; // no occurrence of the alias has an index to match
+      }
+      std::stable_sort( candidates.begin(), candidates.end(),
+                        [](const std::pair<uint32_t,uint32_t>& a, const std::pair<uint32_t,uint32_t>& b)
+                        { return a.first > b.first; } );
+
+      stack.assign( 1, pattern_head );
+      while( !stack.empty() )
+      {
+        const StringTreeNode* leaf = stack.back();
+        stack.pop_back();
+        for (const auto& child: leaf->children() ) { stack.push_back( &child ); }
+
+        if( !leaf->children().empty() ) continue;
+
+        std::vector<RenameTemplate>& leaf_templates = cache.templates[ leaf->index() ];
+        if( !leaf_templates.empty() && leaf_templates.back().rule == r )
+        {
+          continue; // already renamed by an outer occurrence of the pattern
+        }
+
+        // Visit the branch from the leaf to the root. The substitution replaces the
+        // pattern and its "@" consumes the index of the pattern.
+        int position = placeholders_count[ leaf->index() ] - 1;
+        bool valid = true;
+        reversed.clear();
+
+        auto pushNode = [&](const StringTreeNode* node)
+        {
+          RenameToken token;
+          if( isNumberPlaceholder( node->value() ) )
+          {
+            valid = valid && position >= 0;
+            token.kind = RenameToken::INDEX;
+            token.index_pos = static_cast<uint16_t>( position-- );
+          }
+          else{
+            token.kind = RenameToken::TEXT;
+            token.text = node->value();
+          }
+          reversed.push_back( std::move(token) );
+        };
+
+        const StringTreeNode* node = leaf;
+        while( node != pattern_head )
+        {
+          pushNode( node );
+          node = node->parent();
+        }
+        for (int i = rule.substitution().size()-1; i >= 0; i--)
+        {
+          const boost::string_ref& str_val = rule.substitution()[i];
+          RenameToken token;
+          if( isSubstitutionPlaceholder(str_val) )
+          {
+            token.kind = RenameToken::ALIAS;
+            position--;
+          }
+          else{
+            token.kind = RenameToken::TEXT;
+            token.text = str_val.to_string();
+          }
+          reversed.push_back( std::move(token) );
+        }
+        for (size_t p = 0; p < rule.pattern().size() && node; p++)
         {
-          RulesCache cache(rule);
-          FindPattern( cache.rule->pattern(), 0, msg_info.string_tree.croot(), &cache.pattern_head );
-          FindPattern( cache.rule->alias(),   0, msg_info.string_tree.croot(), &cache.alias_head );
-          if( cache.pattern_head && cache.alias_head
-              && std::find( cache_vector.begin(), cache_vector.end(), cache) == cache_vector.end()
-              )
+          node = node->parent();
+        }
+        while( node )
+        {
+          pushNode( node );
+          node = node->parent();
+        }
+
+        if( !valid ) continue;
+
+        RenameTemplate rename;
+        rename.rule = r;
+        for (const auto& candidate: candidates)
+        {
+          rename.alias_tables.push_back( rule_cache.first_table + candidate.second );
+        }
+        rename.pattern_pos = static_cast<uint16_t>( pattern_pos );
+
+        for (int skip_topicname = 0; skip_topicname < 2; skip_topicname++)
+        {
+          std::vector<RenameToken>& tokens = rename.tokens[skip_topicname];
+          // the root is the last token. Consecutive texts are merged.
+          for (size_t i = reversed.size() - skip_topicname; i-- > 0; )
           {
-            cache_vector.push_back( std::move(cache) );
+            const RenameToken& token = reversed[i];
+            if( token.kind == RenameToken::TEXT && !tokens.empty() && tokens.back().kind == RenameToken::TEXT )
+            {
+              tokens.back().text += '/';
+              tokens.back().text += token.text;
+            }
+            else{
+              tokens.push_back( token );
+            }
           }
         }
+        leaf_templates.push_back( std::move(rename) );
       }
     }
   }
@@ -196,14 +763,11 @@ void Parser::registerMessageDefinition(const std::string &msg_definition,
     return; //already registered
   }
   _rule_cache_dirty = true;
+  _transform_caches.erase( msg_definition );
 
-  const boost::regex msg_separation_regex("^\\s*=+\\n+");
-
-  std::vector<std::string> split;
+  const std::vector<std::string> split = SplitMessageDefinitions( definition );
   std::vector<const ROSType*> all_types;
 
-  boost::split_regex(split, definition, msg_separation_regex);
-
   ROSMessageInfo info;
   info.type_list.reserve( split.size() );
 
@@ -226,6 +790,7 @@ void Parser::registerMessageDefinition(const std::string &msg_definition,
   //------------------------------
 
   createTrees(info, msg_definition);
+  compilePlan(info);
 
   //  std::cout << info.string_tree << std::endl;
   //  std::cout << info.message_tree << std::endl;
@@ -338,425 +903,1073 @@ void ExpandVectorIfNecessary(Container& container, size_t new_size)
     }
 }
 
+[[noreturn]] static void ThrowSizeMismatch(size_t expected_size, size_t buffer_size, const std::string& msg_identifier)
+{
+  char msg_buff[1000];
+  sprintf(msg_buff, "buildRosFlatType: There was an error parsing the buffer.\n"
+                    "Size %d != %d, while parsing [%s]",
+          (int) expected_size, (int)buffer_size, msg_identifier.c_str() );
 
-bool Parser::deserializeIntoFlatContainer(const std::string& msg_identifier,
-                                          Span<uint8_t> buffer,
-                                          FlatMessage* flat_container,
-                                          const uint32_t max_array_size ) const
+  throw std::runtime_error(msg_buff);
+}
+
+// Strings and blobs are stored in the same way by FlatMessage and FlatMessageSoA
+template <class Container>
+class StringAndBlobWriter
 {
+public:
+  StringAndBlobWriter(Container* flat, Parser::BlobPolicy blob_policy,
+                      Parser::StringPolicy string_policy):
+    _flat(flat), _blob_policy(blob_policy), _string_policy(string_policy),
+    _name_index(0), _blob_index(0), _blob_storage_index(0)
+  {}
+
+  void storeString(const StringTreeLeaf& leaf, const char* data, size_t size)
+  {
+    if( _string_policy == Parser::STORE_STRING_AS_COPY )
+    {
+      ExpandVectorIfNecessary( _flat->name, _name_index);
+      auto& dst = _flat->name[_name_index++];
+      dst.second.assign( data, size );
+      dst.first.node_ptr    = leaf.node_ptr;
+      dst.first.index_array = leaf.index_array;
+    }
+    else{
+      ExpandVectorIfNecessary( _flat->name_ref, _name_index);
+      auto& dst = _flat->name_ref[_name_index++];
+      dst.second = boost::string_ref( data, size );
+      dst.first.node_ptr    = leaf.node_ptr;
+      dst.first.index_array = leaf.index_array;
+    }
+  }
 
-  bool entire_message_parse = true;
-  const ROSMessageInfo* msg_info = getMessageInfo(msg_identifier);
+  void storeBlob(const StringTreeLeaf& leaf, const uint8_t* data, size_t size)
+  {
+    ExpandVectorIfNecessary( _flat->blob, _blob_index);
+    _flat->blob[_blob_index].first = leaf;
+    auto& blob = _flat->blob[_blob_index].second;
+    _blob_index++;
+
+    if( _blob_policy == Parser::STORE_BLOB_AS_COPY)
+    {
+      ExpandVectorIfNecessary( _flat->blob_storage, _blob_storage_index);
 
-  size_t value_index = 0;
-  size_t name_index = 0;
-  size_t blob_index = 0;
-  size_t blob_storage_index = 0;
+      auto& storage = _flat->blob_storage[_blob_storage_index];
+      storage.resize(size);
+      std::memcpy(storage.data(), data, size);
+      _blob_storage_index++;
 
-  if( msg_info == nullptr)
+      blob = Span<uint8_t>( storage.data(), storage.size() );
+    }
+    else{
+      blob = Span<uint8_t>( const_cast<uint8_t*>(data), size);
+    }
+  }
+
+  void finish()
   {
-    throw std::runtime_error("deserializeIntoFlatContainer: msg_identifier not registerd. Use registerMessageDefinition" );
+    const bool copy_strings = ( _string_policy == Parser::STORE_STRING_AS_COPY );
+    _flat->name.resize( copy_strings ? _name_index : 0 );
+    _flat->name_ref.resize( copy_strings ? 0 : _name_index );
+    _flat->blob.resize( _blob_index );
+    _flat->blob_storage.resize( _blob_storage_index );
   }
-  size_t buffer_offset = 0;
 
-  std::function<void(const MessageTreeNode*,StringTreeLeaf,bool)> deserializeImpl;
+  Parser::BlobPolicy blobPolicy() const { return _blob_policy; }
 
-  deserializeImpl = [&](
-      const MessageTreeNode* msg_node,
-      const StringTreeLeaf& tree_leaf,
-      bool DO_STORE)
-  {
-    const ROSMessage* msg_definition = msg_node->value();
-    size_t index_s = 0;
-    size_t index_m = 0;
+  Parser::StringPolicy stringPolicy() const { return _string_policy; }
 
-    for (const ROSField& field : msg_definition->fields() )
-    {
-      if(field.isConstant() ) continue;
+  ShapeCache* shapeCache() { return &_flat->shape_cache; }
 
-      const ROSType&  field_type = field.type();
+  bool truncatesArrays() const { return true; }
 
-      auto new_tree_leaf = tree_leaf;
-      new_tree_leaf.node_ptr = tree_leaf.node_ptr->child(index_s);
+  // true if the container still has the layout recorded in the ShapeCache
+  bool matchesShape(const ShapeCache& shape) const
+  {
+    const size_t name_count = ( _string_policy == Parser::STORE_STRING_AS_COPY ) ?
+          _flat->name.size() : _flat->name_ref.size();
+    return name_count == shape.strings.size() &&
+        _flat->blob.size() == shape.blobs.size() &&
+        ( _blob_policy != Parser::STORE_BLOB_AS_COPY || _flat->blob_storage.size() == shape.blobs.size() );
+  }
 
-      int32_t array_size = field.arraySize();
-      if( array_size == -1)
-      {
-        ReadFromBuffer( buffer, buffer_offset, array_size );
-      }
-      if( field.isArray())
-      {
-        new_tree_leaf.index_array.push_back(0);
-        new_tree_leaf.node_ptr = new_tree_leaf.node_ptr->child(0);
-      }
+  void rewriteString(size_t index, const uint8_t* data, size_t size)
+  {
+    const char* str = reinterpret_cast<const char*>(data);
+    if( _string_policy == Parser::STORE_STRING_AS_COPY )
+    {
+      _flat->name[index].second.assign( str, size );
+    }
+    else{
+      _flat->name_ref[index].second = boost::string_ref( str, size );
+    }
+  }
 
-      bool IS_BLOB = false;
+  void rewriteBlob(size_t index, const uint8_t* data, size_t size)
+  {
+    auto& blob = _flat->blob[index].second;
+    if( _blob_policy == Parser::STORE_BLOB_AS_COPY)
+    {
+      auto& storage = _flat->blob_storage[index];
+      storage.resize(size);
+      std::memcpy(storage.data(), data, size);
+      blob = Span<uint8_t>( storage.data(), storage.size() );
+    }
+    else{
+      blob = Span<uint8_t>( const_cast<uint8_t*>(data), size);
+    }
+  }
 
-      // Stop storing it if is NOT a blob and a very large array.
-      if( array_size > static_cast<int32_t>(max_array_size))
-      {
-        if( builtinSize(field_type.typeID()) == 1){
-          IS_BLOB = true;
-        }
-        else{
-          if( _discard_large_array ){
-             DO_STORE = false;
-          }
-          entire_message_parse = false;
-        }
-      }
+protected:
+  Container* _flat;
 
-      if( IS_BLOB ) // special case. This is a "blob", typically an image, a map, pointcloud, etc.
-      {
-        ExpandVectorIfNecessary( flat_container->blob, blob_index);
+private:
+  Parser::BlobPolicy _blob_policy;
+  Parser::StringPolicy _string_policy;
+  size_t _name_index;
+  size_t _blob_index;
+  size_t _blob_storage_index;
+};
 
-        if( buffer_offset + array_size > buffer.size() )
-        {
-          throw std::runtime_error("Buffer overrun in deserializeIntoFlatContainer (blob)");
-        }
-        if( DO_STORE )
-        {
-          flat_container->blob[blob_index].first  = new_tree_leaf ;
-          auto& blob = flat_container->blob[blob_index].second;
-          blob_index++;
+// Writes the output of DeserializeWithPlan into a FlatMessage
+class FlatMessageWriter: public StringAndBlobWriter<FlatMessage>
+{
+public:
+  FlatMessageWriter(FlatMessage* flat, Parser::BlobPolicy blob_policy,
+                    Parser::StringPolicy string_policy):
+    StringAndBlobWriter(flat, blob_policy, string_policy),
+    _value_index(0)
+  {}
 
-          if( _blob_policy == STORE_BLOB_AS_COPY)
-          {
-            ExpandVectorIfNecessary( flat_container->blob_storage, blob_storage_index);
+  void reset() {}
 
-            auto& storage = flat_container->blob_storage[blob_storage_index];
-            storage.resize(array_size);
-            std::memcpy(storage.data(), &buffer[buffer_offset], array_size);
-            blob_storage_index++;
+  bool matchesShape(const ShapeCache& shape) const
+  {
+    return StringAndBlobWriter::matchesShape( shape ) &&
+        _flat->value.size() == shape.value_count;
+  }
 
-            blob = Span<uint8_t>( storage.data(), storage.size() );
-          }
-          else{
-            blob = Span<uint8_t>( &buffer[buffer_offset], array_size);
-          }
-        }
-        buffer_offset += array_size;
-      }
-      else // NOT a BLOB
-      {
-        bool DO_STORE_ARRAY = DO_STORE;
-        for (int i=0; i<array_size; i++ )
-        {
-          if( DO_STORE_ARRAY && i >= max_array_size )
-          {
-              DO_STORE_ARRAY = false;
-          }
+  template <size_t ELEM_SIZE>
+  void rewriteValues(size_t first, BuiltinType type, const uint8_t* src, size_t count)
+  {
+    auto* dst = &_flat->value[first];
+    for (size_t i=0; i < count; i++)
+    {
+      dst[i].second.assignRaw( type, src + i*ELEM_SIZE, ELEM_SIZE );
+    }
+  }
 
-          if( field.isArray() && DO_STORE_ARRAY )
-          {
-            new_tree_leaf.index_array.back() = i;
-          }
+  void reserveValues(size_t count)
+  {
+    auto& values = _flat->value;
+    if( values.size() < _value_index + count )
+    {
+      values.resize( std::max( _value_index + count, values.size() * 2 ) );
+    }
+  }
 
-          if( field_type.typeID() == STRING )
-          {
-            ExpandVectorIfNecessary( flat_container->name, name_index);
+  void storeValue(const StringTreeLeaf& leaf, BuiltinType type, const uint8_t* data, size_t size)
+  {
+    ExpandVectorIfNecessary( _flat->value, _value_index);
+    auto& dst = _flat->value[_value_index++];
+    dst.first.node_ptr    = leaf.node_ptr;
+    dst.first.index_array = leaf.index_array;
+    dst.second.assignRaw( type, data, size );
+  }
 
-            uint32_t string_size = 0;
-            ReadFromBuffer( buffer, buffer_offset, string_size );
+  // reserveValues must be called first
+  void storeFixedLeaf(const FixedLeaf& leaf, const uint8_t* data)
+  {
+    auto& dst = _flat->value[_value_index++];
+    dst.first.node_ptr    = leaf.node;
+    dst.first.index_array = leaf.index_array;
+    dst.second.assignRaw( leaf.type, data + leaf.offset, leaf.size );
+  }
 
-            if( buffer_offset + string_size > buffer.size())
-            {
-                throw std::runtime_error("Buffer overrun in RosIntrospection::ReadFromBuffer");
-            }
+  // Store [count] consecutive builtins of size ELEM_SIZE. The last element of
+  // leaf.index_array is replaced by the position in the array.
+  template <size_t ELEM_SIZE>
+  void storeArray(const StringTreeLeaf& leaf, BuiltinType type, const uint8_t* src, size_t count)
+  {
+    reserveValues( count );
+    auto* dst = &_flat->value[_value_index];
+    const size_t last = leaf.index_array.size() - 1;
+    for (size_t i=0; i < count; i++)
+    {
+      dst[i].first.node_ptr    = leaf.node_ptr;
+      dst[i].first.index_array = leaf.index_array;
+      dst[i].first.index_array[last] = i;
+      dst[i].second.assignRaw( type, src + i*ELEM_SIZE, ELEM_SIZE );
+    }
+    _value_index += count;
+  }
 
-            if( DO_STORE_ARRAY )
-            {
-              const char* buffer_ptr = reinterpret_cast<const char*>( &buffer[buffer_offset] );
-              flat_container->name[name_index].second.assign( buffer_ptr, string_size);
-              flat_container->name[name_index].first = new_tree_leaf ;
-              name_index++;
-            }
-            buffer_offset += string_size;
-          }
-          else if( field_type.isBuiltin() )
-          {
-            ExpandVectorIfNecessary( flat_container->value, value_index);
+  void finish()
+  {
+    StringAndBlobWriter::finish();
+    _flat->value.resize( _value_index );
+  }
 
-            Variant var = ReadFromBufferToVariant( field_type.typeID(),
-                                                   buffer,
-                                                   buffer_offset );
-            if( DO_STORE_ARRAY )
-            {
-              flat_container->value[value_index] = std::make_pair( new_tree_leaf, std::move(var) );
-              value_index++;
-            }
-          }
-          else{ // field_type.typeID() == OTHER
+private:
+  size_t _value_index;
+};
 
-            deserializeImpl(msg_node->child(index_m),
-                            new_tree_leaf,
-                            DO_STORE_ARRAY);
-          }
-        } // end for array_size
-      }
+// Writes the output of DeserializeWithPlan into a FlatMessageSoA
+class FlatMessageSoAWriter: public StringAndBlobWriter<FlatMessageSoA>
+{
+public:
+  FlatMessageSoAWriter(FlatMessageSoA* flat, Parser::BlobPolicy blob_policy,
+                       Parser::StringPolicy string_policy):
+    StringAndBlobWriter(flat, blob_policy, string_policy)
+  { }
 
-      if( field_type.typeID() == OTHER )
-      {
-        index_m++;
-      }
-      index_s++;
-    } // end for fields
-  }; //end of lambda
+  void reset()
+  {
+    _flat->leaf.clear();
+    _flat->type.clear();
+    _flat->payload.clear();
+    _flat->indices.clear();
+  }
 
+  bool matchesShape(const ShapeCache& shape) const
+  {
+    return StringAndBlobWriter::matchesShape( shape ) &&
+        _flat->leaf.size() == shape.value_count &&
+        _flat->payload.size() == shape.value_count;
+  }
 
-  flat_container->tree = &msg_info->string_tree;
+  template <size_t ELEM_SIZE>
+  void rewriteValues(size_t first, BuiltinType, const uint8_t* src, size_t count)
+  {
+    uint64_t* payload = &_flat->payload[first];
+    for (size_t i=0; i < count; i++)
+    {
+      payload[i] = 0;
+      std::memcpy( &payload[i], src + i*ELEM_SIZE, ELEM_SIZE );
+    }
+  }
 
-  StringTreeLeaf rootnode;
-  rootnode.node_ptr = msg_info->string_tree.croot();
+  void reserveValues(size_t count)
+  {
+    const size_t new_size = _flat->leaf.size() + count;
+    _flat->leaf.reserve( new_size );
+    _flat->type.reserve( new_size );
+    _flat->payload.reserve( new_size );
+  }
 
-  deserializeImpl( msg_info->message_tree.croot(),
-                   rootnode,
-                   true);
+  void storeValue(const StringTreeLeaf& leaf, BuiltinType type, const uint8_t* data, size_t size)
+  {
+    storeValue( leaf.node_ptr, leaf.index_array, type, data, size );
+  }
 
-  flat_container->name.resize( name_index );
-  flat_container->value.resize( value_index );
-  flat_container->blob.resize( blob_index );
-  flat_container->blob_storage.resize( blob_storage_index );
+  void storeFixedLeaf(const FixedLeaf& leaf, const uint8_t* data)
+  {
+    storeValue( leaf.node, leaf.index_array, leaf.type, data + leaf.offset, leaf.size );
+  }
 
-  if( buffer_offset != buffer.size() )
+  template <size_t ELEM_SIZE>
+  void storeArray(const StringTreeLeaf& leaf, BuiltinType type, const uint8_t* src, size_t count)
   {
-      char msg_buff[1000];
-      sprintf(msg_buff, "buildRosFlatType: There was an error parsing the buffer.\n"
-                      "Size %d != %d, while parsing [%s]",
-              (int) buffer_offset, (int)buffer.size(), msg_identifier.c_str() );
+    const size_t first = _flat->leaf.size();
+    const size_t depth = leaf.index_array.size();
+    const size_t first_index = _flat->indices.size();
+    const uint32_t node_index = leaf.node_ptr->index();
+
+    _flat->leaf.resize( first + count );
+    _flat->type.resize( first + count, static_cast<uint8_t>(type) );
+    _flat->payload.resize( first + count, 0 );
+    _flat->indices.resize( first_index + count*depth );
+
+    uint64_t* payload = &_flat->payload[first];
+    for (size_t i=0; i < count; i++)
+    {
+      std::memcpy( &payload[i], src + i*ELEM_SIZE, ELEM_SIZE );
+    }
 
-      throw std::runtime_error(msg_buff);
+    LeafId* leaf_id = &_flat->leaf[first];
+    uint16_t* indices = &_flat->indices[first_index];
+    for (size_t i=0; i < count; i++)
+    {
+      leaf_id[i].node_index   = node_index;
+      leaf_id[i].index_offset = first_index + i*depth;
+      std::copy( leaf.index_array.begin(), leaf.index_array.end(), indices );
+      indices[depth-1] = i;
+      indices += depth;
+    }
   }
-  return entire_message_parse;
-}
 
-inline bool isNumberPlaceholder( const boost::string_ref& s)
+private:
+  template <typename IndexArray>
+  void storeValue(const StringTreeNode* node, const IndexArray& index_array,
+                  BuiltinType type, const uint8_t* data, size_t size)
+  {
+    uint64_t payload = 0;
+    std::memcpy( &payload, data, size );
+    LeafId leaf_id;
+    leaf_id.node_index   = node->index();
+    leaf_id.index_offset = _flat->indices.size();
+    _flat->leaf.push_back( leaf_id );
+    _flat->type.push_back( static_cast<uint8_t>(type) );
+    _flat->payload.push_back( payload );
+    _flat->indices.insert( _flat->indices.end(), index_array.begin(), index_array.end() );
+  }
+};
+
+// Writes the values decoded by DeserializeWithPlan directly into RenamedValues (or RenamedKeyIds).
+// The leaves and the strings are stored into a RenameState, to create the keys later.
+template <class Output>
+class RenameWriter
 {
-  return s.size() == 1 && s[0] == '#';
+public:
+  RenameWriter(Output* output, RenameState* state):
+    _output(output), _state(state), _value_index(0), _name_index(0), _blob_count(0)
+  {}
+
+  void reset() {}
+
+  // Blobs are discarded and the strings are needed only until the keys are created.
+  Parser::BlobPolicy blobPolicy() const { return Parser::STORE_BLOB_AS_REFERENCE; }
+
+  Parser::StringPolicy stringPolicy() const { return Parser::STORE_STRING_AS_REFERENCE; }
+
+  ShapeCache* shapeCache() { return &_state->shape_cache; }
+
+  bool truncatesArrays() const { return true; }
+
+  bool matchesShape(const ShapeCache& shape) const
+  {
+    return _output->size() == shape.value_count &&
+        _state->leaf.size() == shape.value_count &&
+        _state->name_ref.size() == shape.strings.size() &&
+        _state->blob_count == shape.blobs.size();
+  }
+
+  template <size_t ELEM_SIZE>
+  void rewriteValues(size_t first, BuiltinType type, const uint8_t* src, size_t count)
+  {
+    auto* dst = &(*_output)[first];
+    for (size_t i=0; i < count; i++)
+    {
+      dst[i].second.assignRaw( type, src + i*ELEM_SIZE, ELEM_SIZE );
+    }
+  }
+
+  void rewriteString(size_t index, const uint8_t* data, size_t size)
+  {
+    _state->name_ref[index].second = boost::string_ref( reinterpret_cast<const char*>(data), size );
+  }
+
+  void rewriteBlob(size_t, const uint8_t*, size_t) {}
+
+  void reserveValues(size_t count)
+  {
+    if( _output->size() < _value_index + count )
+    {
+      _output->resize( std::max( _value_index + count, _output->size() * 2 ) );
+    }
+    if( _state->leaf.size() < _value_index + count )
+    {
+      _state->leaf.resize( std::max( _value_index + count, _state->leaf.size() * 2 ) );
+    }
+  }
+
+  void storeValue(const StringTreeLeaf& leaf, BuiltinType type, const uint8_t* data, size_t size)
+  {
+    reserveValues( 1 );
+    StringTreeLeaf& dst_leaf = _state->leaf[_value_index];
+    dst_leaf.node_ptr    = leaf.node_ptr;
+    dst_leaf.index_array = leaf.index_array;
+    (*_output)[_value_index++].second.assignRaw( type, data, size );
+  }
+
+  // reserveValues must be called first
+  void storeFixedLeaf(const FixedLeaf& leaf, const uint8_t* data)
+  {
+    StringTreeLeaf& dst_leaf = _state->leaf[_value_index];
+    dst_leaf.node_ptr    = leaf.node;
+    dst_leaf.index_array = leaf.index_array;
+    (*_output)[_value_index++].second.assignRaw( leaf.type, data + leaf.offset, leaf.size );
+  }
+
+  template <size_t ELEM_SIZE>
+  void storeArray(const StringTreeLeaf& leaf, BuiltinType type, const uint8_t* src, size_t count)
+  {
+    reserveValues( count );
+    auto* dst = &(*_output)[_value_index];
+    StringTreeLeaf* dst_leaf = &_state->leaf[_value_index];
+    const size_t last = leaf.index_array.size() - 1;
+    for (size_t i=0; i < count; i++)
+    {
+      dst_leaf[i].node_ptr    = leaf.node_ptr;
+      dst_leaf[i].index_array = leaf.index_array;
+      dst_leaf[i].index_array[last] = i;
+      dst[i].second.assignRaw( type, src + i*ELEM_SIZE, ELEM_SIZE );
+    }
+    _value_index += count;
+  }
+
+  void storeString(const StringTreeLeaf& leaf, const char* data, size_t size)
+  {
+    ExpandVectorIfNecessary( _state->name_ref, _name_index);
+    auto& dst = _state->name_ref[_name_index++];
+    dst.first.node_ptr    = leaf.node_ptr;
+    dst.first.index_array = leaf.index_array;
+    dst.second = boost::string_ref( data, size );
+  }
+
+  void storeBlob(const StringTreeLeaf&, const uint8_t*, size_t)
+  {
+    _blob_count++;
+  }
+
+  void finish()
+  {
+    _output->resize( _value_index );
+    _state->leaf.resize( _value_index );
+    _state->name_ref.resize( _name_index );
+    _state->blob_count = _blob_count;
+  }
+
+private:
+  Output* _output;
+  RenameState* _state;
+  size_t _value_index;
+  size_t _name_index;
+  size_t _blob_count;
+};
+
+static std::string NodePath(const StringTreeNode* node)
+{
+  std::string path;
+  for( ; node; node = node->parent() )
+  {
+    path = path.empty() ? node->value() : node->value() + "/" + path;
+  }
+  return path;
 }
 
-inline bool isSubstitutionPlaceholder( const boost::string_ref& s)
+[[noreturn]] static void ThrowMalformed(const std::string& msg_identifier, const StringTreeNode* node,
+                                        uint64_t offset, const char* problem)
 {
-  return s.size() == 1 && s[0] == '@';
+  char msg_buff[1000];
+  sprintf(msg_buff, "deserializeIntoFlatContainer: malformed buffer while parsing [%s].\n"
+                    "Offset %lu, field [%s]: %s",
+          msg_identifier.c_str(), (unsigned long) offset,
+          node ? NodePath( node ).c_str() : "", problem );
+
+  throw std::runtime_error(msg_buff);
 }
 
-// given a leaf of the tree, that can have multiple index_array,
-// find the only index which corresponds to the # in the pattern
-inline int  PatternMatchAndIndexPosition(const StringTreeLeaf& leaf,
-                                         const StringTreeNode* pattern_head )
+void details::ThrowParseError(const ParseStatus& status, const std::string& msg_identifier,
+                              size_t buffer_size, Parser::ValidationPolicy policy)
 {
-  const StringTreeNode* node_ptr = leaf.node_ptr;
+  const bool validated = ( policy == Parser::VALIDATE_BEFORE_PARSING );
+  switch( status.code )
+  {
+  case ParseStatus::OK: break;
+
+  case ParseStatus::UNKNOWN_MESSAGE:
+    throw std::runtime_error("deserializeIntoFlatContainer: msg_identifier not registerd. Use registerMessageDefinition" );
+
+  case ParseStatus::BUFFER_OVERRUN:
+    if( validated ){
+      ThrowMalformed( msg_identifier, status.node, status.offset, "the field exceeds the buffer" );
+    }
+    throw std::runtime_error("Buffer overrun in RosIntrospection::ReadFromBuffer");
 
-  int pos = leaf.index_array.size() -1;
+  case ParseStatus::PREFIX_OVERRUN:
+    if( validated ){
+      ThrowMalformed( msg_identifier, status.node, status.offset, "the length prefix exceeds the buffer" );
+    }
+    throw std::runtime_error("Buffer overrun in RosIntrospection::ReadFromBuffer");
+
+  case ParseStatus::SIZE_MISMATCH:
+    ThrowSizeMismatch( status.offset, buffer_size, msg_identifier );
+
+  case ParseStatus::OUT_OF_MEMORY:
+    throw std::bad_alloc();
+  }
+}
 
-  while( node_ptr )
+// true if the buffer has the same shape recorded in the cache
+static bool MatchShape(const ShapeCache& shape, Span<uint8_t> buffer)
+{
+  if( shape.buffer_size != buffer.size() )
   {
-    if( node_ptr != pattern_head )
+    return false;
+  }
+  const uint8_t* data = buffer.data();
+  for (const auto& prefix: shape.prefixes)
+  {
+    uint32_t value;
+    std::memcpy( &value, data + prefix.first, sizeof(uint32_t) );
+    if( value != prefix.second )
     {
-      if( isNumberPlaceholder( node_ptr->value() ))
-      {
-        pos--;
-      }
+      return false;
     }
-    else{
-      return pos;
+  }
+  return true;
+}
+
+// If the buffer has the same shape of the previous message, the leaves stored by
+// the writer are still valid: only their values are copied again. Returns false otherwise.
+template <class Writer>
+static bool RewriteCachedShape(const ROSMessageInfo& msg_info,
+                               Span<uint8_t> buffer,
+                               const uint32_t max_array_size,
+                               const bool discard_large_array,
+                               Writer& writer,
+                               ParseStatus* status)
+{
+  const ShapeCache& shape = *writer.shapeCache();
+  if( shape.info != &msg_info ||
+      shape.plan_version != msg_info.plan_version ||
+      shape.max_array_size != max_array_size ||
+      shape.discard_large_array != discard_large_array ||
+      shape.blob_policy != writer.blobPolicy() ||
+      shape.string_policy != writer.stringPolicy() ||
+      !writer.matchesShape( shape ) ||
+      !MatchShape( shape, buffer ) )
+  {
+    return false;
+  }
+  const uint8_t* data = buffer.data();
+  size_t index = 0;
+  for (const ShapeCache::ValueRun& run: shape.values)
+  {
+    const uint8_t* src = data + run.offset;
+    switch( builtinSize(run.type) )
+    {
+    case 1: writer.template rewriteValues<1>( index, run.type, src, run.count ); break;
+    case 2: writer.template rewriteValues<2>( index, run.type, src, run.count ); break;
+    case 4: writer.template rewriteValues<4>( index, run.type, src, run.count ); break;
+    case 8: writer.template rewriteValues<8>( index, run.type, src, run.count ); break;
     }
-    node_ptr = node_ptr->parent();
-  } // end while
-  return -1;
+    index += run.count;
+  }
+  for (size_t i=0; i < shape.strings.size(); i++)
+  {
+    writer.rewriteString( i, data + shape.strings[i].first, shape.strings[i].second );
+  }
+  for (size_t i=0; i < shape.blobs.size(); i++)
+  {
+    writer.rewriteBlob( i, data + shape.blobs[i].first, shape.blobs[i].second );
+  }
+  status->entire_message_parse = shape.entire_message_parse;
+  return true;
 }
 
-template <typename VectorType>
-inline void JoinStrings( const VectorType& vect, const char separator, std::string& destination)
+// Memory allocation is the only source of exceptions left in DeserializeWithPlan.
+template <class Writer>
+static ParseStatus DeserializeNoThrow(const ROSMessageInfo& msg_info,
+                                      Span<uint8_t> buffer,
+                                      const uint32_t max_array_size,
+                                      const bool discard_large_array,
+                                      Parser::ValidationPolicy validation_policy,
+                                      Writer& writer) noexcept
 {
-  size_t count = 0;
-  for(const auto &v: vect ) count += v.size();
+  try{
+    ParseStatus status;
+    if( RewriteCachedShape( msg_info, buffer, max_array_size, discard_large_array, writer, &status ) )
+    {
+      return status;
+    }
+    return details::Deserialize( msg_info, buffer, max_array_size, discard_large_array,
+                                 validation_policy, writer );
+  }
+  catch( std::bad_alloc& )
+  {
+    return details::ParseError( ParseStatus::OUT_OF_MEMORY, 0, nullptr );
+  }
+}
+
+ParseStatus Parser::tryDeserializeIntoFlatContainer(const std::string& msg_identifier,
+                                                    Span<uint8_t> buffer,
+                                                    FlatMessage* flat_container,
+                                                    const uint32_t max_array_size ) const noexcept
+{
+  const ROSMessageInfo* msg_info = getMessageInfo(msg_identifier);
+  if( msg_info == nullptr)
+  {
+    return details::ParseError( ParseStatus::UNKNOWN_MESSAGE, 0, nullptr );
+  }
+  flat_container->tree = &msg_info->string_tree;
 
-  // the following approach seems to be faster
-  // https://github.com/facontidavide/InterestingBenchmarks/blob/master/StringAppend_vs_Memcpy.md
+  FlatMessageWriter writer( flat_container, _blob_policy, _string_policy );
+  return DeserializeNoThrow( *msg_info, buffer, max_array_size,
+                             _discard_large_array, _validation_policy, writer );
+}
 
-  destination.resize( count + vect.size() -1 );
+ParseStatus Parser::tryDeserializeIntoFlatContainer(const std::string& msg_identifier,
+                                                    Span<uint8_t> buffer,
+                                                    FlatMessageSoA* flat_container,
+                                                    const uint32_t max_array_size ) const noexcept
+{
+  const ROSMessageInfo* msg_info = getMessageInfo(msg_identifier);
+  if( msg_info == nullptr)
+  {
+    return details::ParseError( ParseStatus::UNKNOWN_MESSAGE, 0, nullptr );
+  }
+  flat_container->tree = &msg_info->string_tree;
 
-  char* buffer = &destination[0];
-  size_t buff_pos = 0;
+  FlatMessageSoAWriter writer( flat_container, _blob_policy, _string_policy );
+  return DeserializeNoThrow( *msg_info, buffer, max_array_size,
+                             _discard_large_array, _validation_policy, writer );
+}
 
-  for (size_t c = 0; c < vect.size()-1; c++)
+bool Parser::deserializeIntoFlatContainer(const std::string& msg_identifier,
+                                          Span<uint8_t> buffer,
+                                          FlatMessage* flat_container,
+                                          const uint32_t max_array_size ) const
+{
+  const ParseStatus status = tryDeserializeIntoFlatContainer( msg_identifier, buffer,
+                                                              flat_container, max_array_size );
+  if( !status.ok() )
   {
-    const size_t S = vect[c].size();
-    std::memcpy( &buffer[buff_pos], vect[c].data(), S );
-    buff_pos += S;
-    buffer[buff_pos++] = separator;
+    details::ThrowParseError( status, msg_identifier, buffer.size(), _validation_policy );
   }
-  std::memcpy( &buffer[buff_pos], vect.back().data(), vect.back().size() );
+  return status.entire_message_parse;
 }
 
-void Parser::applyNameTransform(const std::string& msg_identifier,
-                                const FlatMessage& container,
-                                RenamedValues *renamed_value,
-                                bool skip_topicname)
+bool Parser::deserializeIntoFlatContainer(const std::string& msg_identifier,
+                                          Span<uint8_t> buffer,
+                                          FlatMessageSoA* flat_container,
+                                          const uint32_t max_array_size ) const
+{
+  const ParseStatus status = tryDeserializeIntoFlatContainer( msg_identifier, buffer,
+                                                              flat_container, max_array_size );
+  if( !status.ok() )
+  {
+    details::ThrowParseError( status, msg_identifier, buffer.size(), _validation_policy );
+  }
+  return status.entire_message_parse;
+}
+
+
+template <class Output>
+bool Parser::deserializeAndRenameInto(const std::string& msg_identifier,
+                                      Span<uint8_t> buffer,
+                                      Output* renamed_value,
+                                      const uint32_t max_array_size,
+                                      bool skip_topicname)
 {
+  const ROSMessageInfo* msg_info = getMessageInfo(msg_identifier);
+  if( msg_info == nullptr)
+  {
+    details::ThrowParseError( details::ParseError( ParseStatus::UNKNOWN_MESSAGE, 0, nullptr ),
+                     msg_identifier, buffer.size(), _validation_policy );
+  }
   if( _rule_cache_dirty )
   {
     updateRuleCache();
   }
-  auto rule_found = _rule_caches.find(msg_identifier);
+  TransformCache& transform_cache = _transform_caches[msg_identifier];
+  RenameState& state = transform_cache.state;
+
+  RenameWriter<Output> writer( renamed_value, &state );
+  const ParseStatus status = DeserializeNoThrow( *msg_info, buffer, max_array_size,
+                                                 _discard_large_array, _validation_policy, writer );
+  if( !status.ok() )
+  {
+    // the layout of renamed_value is unknown
+    state.shape_cache.info = nullptr;
+    _last_rename.output = nullptr;
+    details::ThrowParseError( status, msg_identifier, buffer.size(), _validation_policy );
+  }
+
+  _names.clear();
+  for(const auto& it: state.name_ref)
+  {
+    _names.push_back( std::make_pair( &it.first, it.second ) );
+  }
+  auto leafAt = [&state](size_t index) -> const StringTreeLeaf& { return state.leaf[index]; };
+  updateKeyIds( transform_cache, leafAt, state.leaf.size(), skip_topicname );
+  writeKeys( transform_cache, renamed_value );
+
+  return status.entire_message_parse;
+}
+
+bool Parser::deserializeAndRename(const std::string& msg_identifier,
+                                  Span<uint8_t> buffer,
+                                  RenamedValues* renamed_value,
+                                  const uint32_t max_array_size,
+                                  bool skip_topicname)
+{
+  return deserializeAndRenameInto( msg_identifier, buffer, renamed_value, max_array_size, skip_topicname );
+}
+
+bool Parser::deserializeAndRename(const std::string& msg_identifier,
+                                  Span<uint8_t> buffer,
+                                  RenamedKeyIds* renamed_value,
+                                  const uint32_t max_array_size,
+                                  bool skip_topicname)
+{
+  return deserializeAndRenameInto( msg_identifier, buffer, renamed_value, max_array_size, skip_topicname );
+}
+
+// Serialize the leaves and the names of a FlatMessage, to know if they changed
+class FingerprintWriter
+{
+public:
+  FingerprintWriter(std::string& output): _output(output), _size(0) {}
+
+  ~FingerprintWriter() { _output.resize( _size ); }
+
+  void write(const void* data, size_t size)
+  {
+    if( _size + size > _output.size() )
+    {
+      _output.resize( std::max( _output.size()*2, _size + size ) );
+    }
+    memcpy( &_output[_size], data, size );
+    _size += size;
+  }
+
+  void write(const StringTreeLeaf& leaf)
+  {
+    const uint32_t node_index = leaf.node_ptr->index();
+    write( &node_index, sizeof(node_index) );
+    write( leaf.index_array.data(), leaf.index_array.size() * sizeof(uint16_t) );
+  }
+
+  void write(const boost::string_ref& str)
+  {
+    const uint32_t size = str.size();
+    write( &size, sizeof(size) );
+    write( str.data(), size );
+  }
+
+private:
+  std::string& _output;
+  size_t _size;
+};
+
+template <class Output>
+void Parser::applyNameTransformInto(const std::string& msg_identifier,
+                                    const FlatMessage& container,
+                                    Output* renamed_value,
+                                    bool skip_topicname)
+{
+  if( _rule_cache_dirty )
+  {
+    updateRuleCache();
+  }
+  TransformCache& transform_cache = _transform_caches[msg_identifier];
+
+  // the strings are either in container.name or in container.name_ref (see StringPolicy)
+  _names.clear();
+  for(const auto& it: container.name)
+  {
+    _names.push_back( std::make_pair( &it.first, boost::string_ref(it.second) ) );
+  }
+  for(const auto& it: container.name_ref)
+  {
+    _names.push_back( std::make_pair( &it.first, it.second ) );
+  }
 
   const size_t num_values = container.value.size();
-  const size_t num_names  = container.name.size();
+  auto leafAt = [&container](size_t index) -> const StringTreeLeaf& { return container.value[index].first; };
 
-  renamed_value->resize( container.value.size() );
-  //DO NOT clear() renamed_value
+  updateKeyIds( transform_cache, leafAt, num_values, skip_topicname );
+  writeKeys( transform_cache, renamed_value );
+
+  for(size_t value_index=0; value_index < num_values; value_index++)
+  {
+    (*renamed_value)[value_index].second = container.value[value_index].second;
+  }
+}
+
+void Parser::applyNameTransform(const std::string& msg_identifier,
+                                const FlatMessage& container,
+                                RenamedValues *renamed_value,
+                                bool skip_topicname)
+{
+  applyNameTransformInto( msg_identifier, container, renamed_value, skip_topicname );
+}
+
+void Parser::applyNameTransform(const std::string& msg_identifier,
+                                const FlatMessage& container,
+                                RenamedKeyIds *renamed_value,
+                                bool skip_topicname)
+{
+  applyNameTransformInto( msg_identifier, container, renamed_value, skip_topicname );
+}
+
+void Parser::writeKeys(const TransformCache& transform_cache, RenamedValues* renamed_value)
+{
+  const size_t num_values = transform_cache.key_ids.size();
+
+  // The keys written by the last call are still there
+  if( _last_rename.output == renamed_value &&
+      _last_rename.cache == &transform_cache &&
+      _last_rename.key_version == transform_cache.key_version &&
+      renamed_value->size() == num_values &&
+      _last_rename.data == renamed_value->data() )
+  {
+    return;
+  }
 
-  _alias_array_pos.resize( num_names );
-  _formatted_string.reserve( num_values );
-  _formatted_string.clear();
+  renamed_value->resize( num_values );
+  //DO NOT clear() renamed_value
+  _last_rename = { renamed_value, renamed_value->data(), &transform_cache, transform_cache.key_version };
 
-  _substituted.resize( num_values );
-  for(size_t i=0; i<num_values; i++) { _substituted[i] = false; }
+  for(size_t value_index=0; value_index < num_values; value_index++)
+  {
+    (*renamed_value)[value_index].first = _key_dictionary.key( transform_cache.key_ids[value_index] );
+  }
+}
 
-  // size_t renamed_index = 0;
+void Parser::writeKeys(const TransformCache& transform_cache, RenamedKeyIds* renamed_value)
+{
+  const size_t num_values = transform_cache.key_ids.size();
+  renamed_value->resize( num_values );
 
-  if( rule_found != _rule_caches.end() )
+  for(size_t value_index=0; value_index < num_values; value_index++)
   {
-    const std::vector<RulesCache>& rules_cache = rule_found->second;
+    (*renamed_value)[value_index].first = transform_cache.key_ids[value_index];
+  }
+}
+
+template <class LeafAt>
+void Parser::updateKeyIds(TransformCache& transform_cache,
+                          LeafAt leafAt, size_t num_values,
+                          bool skip_topicname)
+{
+  const std::vector<RulesCache>& rules_cache = transform_cache.rules;
+  const size_t num_names  = _names.size();
 
-    for(const RulesCache& cache: rules_cache)
+  // If the leaves and the names are the same of the previous message, so are the keys.
+  {
+    FingerprintWriter writer( _fingerprint );
+    const uint8_t skip = skip_topicname;
+    writer.write( &skip, sizeof(skip) );
+    for(size_t value_index=0; value_index < num_values; value_index++)
+    {
+      writer.write( leafAt(value_index) );
+    }
+    for(const auto& it: _names)
     {
-      const SubstitutionRule* rule         = cache.rule;
-      const StringTreeNode*   pattern_head = cache.pattern_head;
-      const StringTreeNode*   alias_head   = cache.alias_head;
+      writer.write( *it.first );
+      writer.write( it.second );
+    }
+  }
+  if( _fingerprint == transform_cache.fingerprint )
+  {
+    return;
+  }
+  transform_cache.fingerprint.swap( _fingerprint );
+  transform_cache.key_version++;
 
-      if( !pattern_head || !alias_head  ) continue;
+  // Direct table index -> alias for each occurrence of the alias of each rule.
+  // When two names have the same index, the first one is used.
+  _alias_tables.resize( transform_cache.alias_table_count );
+  for(auto& table: _alias_tables)
+  {
+    table.clear();
+  }
+  for(size_t r=0; r < rules_cache.size(); r++)
+  {
+    const RulesCache& cache = rules_cache[r];
 
-      for (size_t n=0; n<num_names; n++)
+    for (size_t n=0; n<num_names; n++)
+    {
+      const StringTreeLeaf& alias_leaf = *_names[n].first;
+      const uint32_t node_index = alias_leaf.node_ptr->index();
+      if( node_index >= cache.alias_of_node.size() || cache.alias_of_node[node_index] < 0 )
       {
-        const StringTreeLeaf& name_leaf = container.name[n].first;
-        _alias_array_pos[n] = PatternMatchAndIndexPosition(name_leaf, alias_head);
+        continue;
       }
-
-      for(size_t value_index = 0; value_index<num_values; value_index++)
+      const int32_t alias = cache.alias_of_node[node_index];
+      if( cache.alias_pos[alias] < 0 )
+      {
+        continue;
+      }
+      std::vector<const boost::string_ref*>& table = _alias_tables[ cache.first_table + alias ];
+      const uint16_t index = alias_leaf.index_array[ cache.alias_pos[alias] ];
+      if( index >= table.size() )
+      {
+        table.resize( index+1, nullptr );
+      }
+      if( !table[index] )
       {
-        if( _substituted[value_index]) continue;
+        table[index] = &_names[n].second;
+      }
+    }
+  }
 
-        const auto& value_leaf = container.value[value_index];
+  LeafNameCache& leaf_names = transform_cache.leaf_names;
+  auto& last_names = leaf_names.last[ skip_topicname ? 1 : 0 ];
+  last_names.resize( num_values, nullptr );
+  transform_cache.key_ids.resize( num_values );
 
-        const StringTreeLeaf& leaf = value_leaf.first;
+  for(size_t value_index=0; value_index < num_values; value_index++)
+  {
+    const StringTreeLeaf& leaf = leafAt( value_index );
+    uint32_t& key_id = transform_cache.key_ids[value_index];
 
-        int pattern_array_pos = PatternMatchAndIndexPosition(leaf,   pattern_head);
+    const uint32_t node_index = leaf.node_ptr->index();
+    bool substituted = false;
 
-        if( pattern_array_pos>= 0) // -1 if pattern doesn't match
+    if( node_index < transform_cache.templates.size() )
+    {
+      for (const RenameTemplate& rename: transform_cache.templates[node_index])
+      {
+        // the names come from the first occurrence of the alias that has any
+        const std::vector<const boost::string_ref*>* table = nullptr;
+        for (uint32_t table_index: rename.alias_tables)
         {
-          boost::string_ref new_name;
-
-          for (size_t n=0; n < num_names; n++)
+          if( !_alias_tables[ table_index ].empty() )
           {
-            const auto & it = container.name[n];
-            const StringTreeLeaf& alias_leaf = it.first;
-
-            if( _alias_array_pos[n] >= 0 ) // -1 if pattern doesn't match
-            {
-              if( alias_leaf.index_array[ _alias_array_pos[n] ] ==
-                  leaf.index_array[ pattern_array_pos] )
-              {
-                new_name = it.second;
-                break;
-              }
-            }
+            table = &_alias_tables[ table_index ];
+            break;
           }
+        }
+        const uint16_t index = leaf.index_array[ rename.pattern_pos ];
+        if( !table || index >= table->size() || !(*table)[index] || (*table)[index]->empty() )
+        {
+          continue;
+        }
+        const boost::string_ref& new_name = *(*table)[index];
 
-          //--------------------------
-          if( !new_name.empty() )
+        _key_buffer.clear();
+        const std::vector<RenameToken>& tokens = rename.tokens[ skip_topicname ? 1 : 0 ];
+        for (size_t t=0; t < tokens.size(); t++)
+        {
+          if( t > 0 ) _key_buffer += '/';
+          switch( tokens[t].kind )
           {
-            boost::container::static_vector<boost::string_ref, 12> concatenated_name;
-
-            const StringTreeNode* node_ptr = leaf.node_ptr;
-
-            int position = leaf.index_array.size()-1;
+          case RenameToken::TEXT: _key_buffer += tokens[t].text; break;
+          case RenameToken::ALIAS: _key_buffer.append( new_name.data(), new_name.size() ); break;
+          case RenameToken::INDEX:{
+            char buffer[16];
+            const int str_size = print_number( buffer, leaf.index_array[ tokens[t].index_pos ] );
+            _key_buffer.append( buffer, str_size );
+          } break;
+          }
+        }
+        key_id = _key_dictionary.insert( _key_buffer );
+        substituted = true;
+        break;
+      }
+    }
+    if( substituted ) continue;
 
-            while( node_ptr != pattern_head)
-            {
-              const boost::string_ref& str_val = node_ptr->value();
-
-              if( isNumberPlaceholder( str_val ) )
-              {
-                char buffer[16];
-                const int number = leaf.index_array[position--];
-                int str_size = print_number( buffer, number );
-                _formatted_string.push_back( std::string(buffer, str_size) );
-                concatenated_name.push_back( _formatted_string.back() );
-              }
-              else{
-                concatenated_name.push_back( str_val );
-              }
-              node_ptr = node_ptr->parent();
-            }
+    // usually the leaf is the same of the previous message: skip the hash table
+    const LeafNameCache::Index::value_type* entry = last_names[value_index];
+    if( !entry || entry->first.node_index != node_index
+        || entry->first.index_array != leaf.index_array )
+    {
+      entry = &findLeafName( leaf_names, leaf, skip_topicname );
+      last_names[value_index] = entry;
+    }
+    key_id = entry->second;
+  }
+}
 
-            for (int s = rule->substitution().size()-1; s >= 0; s--)
-            {
-              const boost::string_ref& str_val = rule->substitution()[s];
-
-              if( isSubstitutionPlaceholder(str_val) )
-              {
-                concatenated_name.push_back( new_name );
-                position--;
-              }
-              else{ concatenated_name.push_back( str_val ); }
-            }
+const std::string& Parser::leafName(const std::string& msg_identifier,
+                                    const StringTreeLeaf& leaf, bool skip_topicname)
+{
+  LeafNameCache& cache = _transform_caches[msg_identifier].leaf_names;
+  return _key_dictionary.key( findLeafName( cache, leaf, skip_topicname ).second );
+}
 
-            for (size_t p = 0; p < rule->pattern().size() && node_ptr; p++)
-            {
-              node_ptr = node_ptr->parent();
-            }
+const Parser::LeafNameCache::Index::value_type& Parser::findLeafName(LeafNameCache& cache,
+                                                                    const StringTreeLeaf& leaf,
+                                                                    bool skip_topicname)
+{
+  LeafNameCache::Index& index = cache.index[ skip_topicname ? 1 : 0 ];
+  LeafKey key( leaf );
+  auto it = index.find( key );
+  if( it == index.end() )
+  {
+    CreateStringFromTreeLeaf( leaf, skip_topicname, _key_buffer );
+    const uint32_t key_id = _key_dictionary.insert( _key_buffer );
+    it = index.insert( std::make_pair( std::move(key), key_id ) ).first;
+  }
+  return *it;
+}
 
-            while( node_ptr )
-            {
-              boost::string_ref str_val = node_ptr->value();
-
-              if( isNumberPlaceholder(str_val) )
-              {
-                char buffer[16];
-                const int number = leaf.index_array[position--];
-                int str_size = print_number( buffer, number );
-                _formatted_string.push_back( std::string(buffer, str_size) );
-                concatenated_name.push_back( _formatted_string.back() );
-              }
-              else{
-                concatenated_name.push_back( str_val );
-              }
-              node_ptr = node_ptr->parent();
-            }
+KeyDictionary::KeyDictionary(const KeyDictionary& other):
+  _ids( other._ids )
+{
+  _keys.resize( _ids.size() );
+  for(const auto& it: _ids)
+  {
+    _keys[it.second] = &it.first;
+  }
+}
 
-            //------------------------
-            auto& renamed_pair = (*renamed_value)[value_index];
+KeyDictionary& KeyDictionary::operator=(const KeyDictionary& other)
+{
+  if( this != &other )
+  {
+    _ids = other._ids;
+    _keys.resize( _ids.size() );
+    for(const auto& it: _ids)
+    {
+      _keys[it.second] = &it.first;
+    }
+  }
+  return *this;
+}
 
-            if( skip_topicname )
-            {
-                concatenated_name.pop_back();
-            }
+uint32_t KeyDictionary::insert(const std::string& key)
+{
+  auto it = _ids.find( key );
+  if( it == _ids.end() )
+  {
+    it = _ids.insert( std::make_pair( key, static_cast<uint32_t>(_keys.size()) ) ).first;
+    _keys.push_back( &it->first );
+  }
+  return it->second;
+}
 
-            std::reverse(concatenated_name.begin(), concatenated_name.end());
-            JoinStrings( concatenated_name, '/', renamed_pair.first);
-            renamed_pair.second  = value_leaf.second ;
+int32_t KeyDictionary::find(const std::string& key) const
+{
+  auto it = _ids.find( key );
+  return ( it == _ids.end() ) ? -1 : static_cast<int32_t>( it->second );
+}
 
-            _substituted[value_index] = true;
+size_t ConvertToDouble(const FlatMessage& msg, std::vector<double>& output, std::vector<uint64_t>& failed)
+{
+  const size_t count = msg.value.size();
+  output.resize( count );
+  failed.resize( (count+63)/64 );
+  return details::ConvertVariantsToDouble(
+        [&msg](size_t i) -> const Variant& { return msg.value[i].second; },
+        count, output.data(), failed.data() );
+}
 
-          }// end if( new_name )
-        }// end if( PatternMatching )
-      } // end for values
-    } // end for rules
-  } //end rule found
+size_t ConvertToDouble(Span<const Variant> values, std::vector<double>& output, std::vector<uint64_t>& failed)
+{
+  output.resize( values.size() );
+  failed.resize( (values.size()+63)/64 );
+  return ConvertToDouble( values.data(), values.size(), output.data(), failed.data() );
+}
 
-  for(size_t value_index=0; value_index< container.value.size(); value_index++)
+size_t ConvertToDouble(const FlatMessageSoA& msg, std::vector<double>& output, std::vector<uint64_t>& failed)
+{
+  const size_t count = msg.size();
+  output.resize( count );
+  failed.assign( (count+63)/64, 0 );
+
+  const uint8_t* raw = reinterpret_cast<const uint8_t*>( msg.payload.data() );
+  size_t errors = 0;
+  size_t i = 0;
+  while( i < count )
   {
-    if( !_substituted[value_index] )
+    const uint8_t type = msg.type[i];
+    size_t run_end = i+1;
+    while( run_end < count && msg.type[run_end] == type )
     {
-      const std::pair<StringTreeLeaf, Variant> & value_leaf = container.value[value_index];
-
-      std::string& destination = (*renamed_value)[value_index].first;
-      CreateStringFromTreeLeaf( value_leaf.first, skip_topicname, destination );
-      (*renamed_value)[value_index].second = value_leaf.second ;
+      run_end++;
     }
+    const auto rawAt = [&](size_t k) -> const uint8_t* { return raw + (i+k)*sizeof(uint64_t); };
+    errors += details::ConvertRunToDouble( static_cast<BuiltinType>(type), rawAt,
+                                           run_end - i, output.data() + i, failed.data(), i );
+    i = run_end;
   }
+  return errors;
 }
 
 }
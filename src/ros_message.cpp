@@ -37,41 +37,115 @@
 #include <boost/utility/string_ref.hpp>
 #include <boost/utility/string_ref.hpp>
 #include "ros_type_introspection/ros_message.hpp"
-#include <boost/regex.hpp>
-#include <boost/algorithm/string/regex.hpp>
 
 namespace RosIntrospection{
 
+// "\s" in the "C" locale.
+static inline bool isSpace(char c) { return c == ' ' || ( c >= '\t' && c <= '\r' ); }
+
+// Besides '\n', also '\f' and '\r' (but not "\r\n") start a new line.
+static inline bool isLineStart(const char* data, size_t pos)
+{
+  const char prev = data[pos-1];
+  return prev == '\n' || prev == '\f' || ( prev == '\r' && data[pos] != '\n' );
+}
+
+// True if a line of the definition is empty or a comment, i.e. if any of the
+// lines that it contains (see isLineStart) is made of spaces, or of spaces and "#".
+static bool IsBlankOrComment(const char* line, size_t size)
+{
+  size_t start = 0;
+  while( true )
+  {
+    bool separator = false;
+    size_t pos = start;
+    while( pos < size && isSpace( line[pos] ) )
+    {
+      separator = separator || line[pos] == '\f' || line[pos] == '\r';
+      pos++;
+    }
+    if( pos == size || separator || line[pos] == '#' )
+    {
+      return true;
+    }
+    // next line start
+    while( pos < size && line[pos] != '\f' && line[pos] != '\r' ) { pos++; }
+    if( pos == size )
+    {
+      return false;
+    }
+    start = pos + 1;
+  }
+}
+
 ROSMessage::ROSMessage(const std::string &msg_def)
 {
-  std::istringstream messageDescriptor(msg_def);
-  boost::match_results<std::string::const_iterator> what;
+  const char* data = msg_def.data();
+  size_t line_begin = 0;
 
-  for (std::string line; std::getline(messageDescriptor, line, '\n') ; )
+  while( line_begin < msg_def.size() )
   {
-    std::string::const_iterator begin = line.begin(), end = line.end();
+    size_t line_end = msg_def.find( '\n', line_begin );
+    if( line_end == std::string::npos )
+    {
+      line_end = msg_def.size();
+    }
+    const size_t next_line = line_end + 1;
 
     // Skip empty line or one that is a comment
-    if (boost::regex_search( begin, end, what,
-                             boost::regex("(^\\s*$|^\\s*#)")))
+    if( IsBlankOrComment( data + line_begin, line_end - line_begin ) )
     {
+      line_begin = next_line;
       continue;
     }
 
     // Trim start of line
-    line.erase(line.begin(), std::find_if(line.begin(), line.end(),
-      std::not1(std::ptr_fun<int, int>(std::isspace))));
+    while( isSpace( data[line_begin] ) ) { line_begin++; }
 
-    if( line.compare(0, 5, "MSG: ") == 0)
+    if( msg_def.compare( line_begin, 5, "MSG: " ) == 0 )
     {
-      line.erase(0,5);
-      _type = ROSType(line);
+      _type = ROSType( msg_def.substr( line_begin + 5, line_end - line_begin - 5 ) );
     }
     else{
-      auto new_field = ROSField(line);
-      _fields.push_back(new_field);
+      _fields.push_back( ROSField( msg_def.substr( line_begin, line_end - line_begin ) ) );
+    }
+    line_begin = next_line;
+  }
+}
+
+std::vector<std::string> SplitMessageDefinitions(const std::string &definition)
+{
+  // A separator is a line made of "=", preceded by any number of empty lines
+  // and followed by the empty ones.
+  const char* data = definition.data();
+  const size_t size = definition.size();
+
+  std::vector<std::string> split;
+  size_t piece_begin = 0;
+  size_t line_begin = 0;
+
+  while( line_begin <= size )
+  {
+    size_t pos = line_begin;
+    while( pos < size && isSpace( data[pos] ) ) { pos++; }
+
+    size_t end = pos;
+    while( end < size && data[end] == '=' ) { end++; }
+
+    if( end > pos && end < size && data[end] == '\n' )
+    {
+      while( end < size && data[end] == '\n' ) { end++; }
+      split.push_back( definition.substr( piece_begin, line_begin - piece_begin ) );
+      piece_begin = end;
+      line_begin = end;
+      continue;
     }
+    // the lines that start inside the spaces give the same result: go to the next one
+    line_begin = pos + 1;
+    while( line_begin <= size && !isLineStart( data, line_begin ) ) { line_begin++; }
   }
+  split.push_back( definition.substr( piece_begin ) );
+  return split;
 }
 
 void ROSMessage::updateMissingPkgNames(const std::vector<const ROSType*> &all_types)
@@ -39,103 +39,129 @@ namespace RosIntrospection{
 
 
 
+// Copy path.text, starting from [first], replacing each "#" with the index of the leaf.
+// [buffer] must have room for path.text plus 5 characters for each placeholder (and a '\0').
+static size_t FormatPath(const StringTreePath& path, size_t first,
+                         const StringTreeLeaf& leaf, char* buffer)
+{
+  const char* text = path.text.data();
+  size_t offset = 0;
+
+  for (size_t i=0; i < path.placeholders.size(); i++)
+  {
+    const size_t placeholder = path.placeholders[i];
+    std::memcpy( &buffer[offset], text + first, placeholder - first );
+    offset += placeholder - first;
+    offset += print_number( &buffer[offset], leaf.index_array[i] );
+    first = placeholder + 1;
+  }
+  std::memcpy( &buffer[offset], text + first, path.text.size() - first );
+  offset += path.text.size() - first;
+  return offset;
+}
+
 int StringTreeLeaf::toStr(char* buffer) const
 {
-  const StringTreeNode* leaf_node = this->node_ptr;
-  if( !leaf_node ){
+  if( !node_ptr ){
     return -1;
   }
+  const size_t offset = FormatPath( node_ptr->path, 0, *this, buffer );
+  buffer[offset] = '\0';
+  return offset;
+}
 
-  boost::container::static_vector<const std::string*, 16> strings_chain;
-
-  while(leaf_node)
+void BuildPathTemplates(StringTree& tree)
+{
+  // the parent of a node is always stored before it
+  for (uint32_t i=0; i < tree.size(); i++)
   {
-    const auto& str = leaf_node->value();
-    strings_chain.push_back( &str );
-    leaf_node = leaf_node->parent();
-  };
+    StringTreeNode* node = tree.node(i);
+    StringTreePath& path = node->path;
+    const StringTreeNode* parent = node->parent();
 
-  std::reverse(strings_chain.begin(),  strings_chain.end() );
-
-  size_t array_count = 0;
-  size_t offset = 0;
+    if( !parent )
+    {
+      path = StringTreePath();
+      path.text = node->value();
+      path.root_size = path.text.size() + 1;
+      continue;
+    }
 
-  for( const auto& str: strings_chain)
-  {
-    const size_t S = str->size();
-    if( S == 1 && (*str)[0] == '#' )
+    path = parent->path;
+    const std::string& str = node->value();
+    if( str.size() == 1 && str[0] == '#' )
     {
-      buffer[offset++] = '.';
-      offset += print_number(&buffer[offset], this->index_array[ array_count++ ] );
+      path.text.push_back( '.' );
+      path.placeholders.push_back( path.text.size() );
+      path.text.push_back( '#' );
     }
     else{
-      if( str !=  strings_chain.front() ){
-        buffer[offset++] = '/';
-      }
-      std::memcpy( &buffer[offset], str->data(), S );
-      offset += S;
+      path.text.push_back( '/' );
+      path.text.append( str );
     }
   }
-  buffer[offset] = '\0';
-  return offset;
 }
 
-
-void CreateStringFromTreeLeaf(const StringTreeLeaf& leaf, bool skip_root, std::string& out)
+int32_t FindNodeByPath(const StringTree& tree, boost::string_ref path)
 {
-  const StringTreeNode* leaf_node = leaf.node_ptr;
-  if( !leaf_node ){
-      out.clear();
-      return ;
-  }
-
-  boost::container::static_vector<const std::string*, 16> strings_chain;
-
-  size_t total_size = 0;
+  const StringTreeNode* node = tree.croot();
+  const boost::string_ref array_node( "#" );
 
-  while(leaf_node)
+  while( !path.empty() )
   {
-    const auto& str = leaf_node->value();
-    leaf_node = leaf_node->parent();
-    if( !( leaf_node == nullptr && skip_root) )
+    size_t length = 0;
+    while( length < path.size() && path[length] != '/' && path[length] != '.' )
     {
-        strings_chain.emplace_back( &str );
-        const size_t S = str.size();
-        if( S == 1 && str[0] == '#' )
-        {
-            total_size += 5; // super conservative
-        }
-        else{
-          total_size += S+1;
-        }
+      length++;
     }
-  };
+    const boost::string_ref name = path.substr( 0, length );
+    path = path.substr( std::min( length + 1, path.size() ) );
 
-  out.resize(total_size);
-  char* buffer = &out[0];
-
-  std::reverse(strings_chain.begin(),  strings_chain.end() );
-
-  size_t array_count = 0;
-  size_t offset = 0;
+    if( name.empty() ) continue;
 
-  for( const auto& str: strings_chain)
-  {
-    const size_t S = str->size();
-    if( S == 1 && (*str)[0] == '#' )
+    const StringTreeNode* array_child = tree.findChild( node, array_node );
+    if( array_child )
     {
-      buffer[offset++] = '.';
-      offset += print_number(&buffer[offset], leaf.index_array[ array_count++ ] );
-    }
-    else{
-      if( str !=  strings_chain.front() ){
-        buffer[offset++] = '/';
+      const bool is_index = std::all_of( name.begin(), name.end(),
+                                         [](char c) { return c >= '0' && c <= '9'; } );
+      node = array_child;
+      if( name == array_node || is_index )
+      {
+        continue;
       }
-      std::memcpy( &buffer[offset], str->data(), S );
-      offset += S;
     }
+    node = tree.findChild( node, name );
+    if( !node )
+    {
+      return -1;
+    }
+  }
+  return node->index();
+}
+
+StringTreeLeaf CreateTreeLeaf(const StringTree& tree, const LeafId& id, const uint16_t* index_arena)
+{
+  StringTreeLeaf leaf;
+  leaf.node_ptr = tree.node( id.node_index );
+
+  const size_t array_count = leaf.node_ptr->path.placeholders.size();
+  leaf.index_array.assign( index_arena + id.index_offset,
+                           index_arena + id.index_offset + array_count );
+  return leaf;
+}
+
+void CreateStringFromTreeLeaf(const StringTreeLeaf& leaf, bool skip_root, std::string& out)
+{
+  const StringTreeNode* leaf_node = leaf.node_ptr;
+  if( !leaf_node ){
+      out.clear();
+      return ;
   }
-  out.resize(offset);
+  const StringTreePath& path = leaf_node->path;
+  const size_t first = skip_root ? std::min<size_t>( path.root_size, path.text.size() ) : 0;
+
+  out.resize( path.text.size() - first + 5 * path.placeholders.size() + 1 );
+  out.resize( FormatPath( path, first, leaf, &out[0] ) );
 }
 
 }
@@ -82,4 +82,88 @@ SubstitutionRule& SubstitutionRule::operator= (const SubstitutionRule& other)
     return *this;
 }
 
+PatternTrie::PatternTrie(): _states(1), _pattern_count(0)
+{}
+
+uint32_t PatternTrie::addPattern(const std::vector<boost::string_ref> &pattern)
+{
+  uint32_t state = 0;
+  for (const boost::string_ref& name: pattern)
+  {
+    if( name.size() == 1 && name[0] == '*' )
+    {
+      if( _states[state].wildcard < 0 )
+      {
+        _states[state].wildcard = _states.size();
+        _states.emplace_back();
+      }
+      state = _states[state].wildcard;
+    }
+    else{
+      auto it = _states[state].next.find( name.to_string() );
+      if( it == _states[state].next.end() )
+      {
+        const uint32_t new_state = _states.size();
+        _states[state].next.insert( std::make_pair( name.to_string(), new_state ) );
+        _states.emplace_back();
+        state = new_state;
+      }
+      else{
+        state = it->second;
+      }
+    }
+  }
+  _states[state].patterns.push_back( _pattern_count );
+  return _pattern_count++;
+}
+
+std::vector< std::vector<uint32_t> > PatternTrie::match(const StringTree &tree) const
+{
+  std::vector< std::vector<uint32_t> > result( _pattern_count );
+  if( tree.croot() )
+  {
+    visit( tree.croot(), std::vector<uint32_t>(), result );
+  }
+  return result;
+}
+
+void PatternTrie::visit(const StringTreeNode *node, const std::vector<uint32_t> &parent_states,
+                        std::vector< std::vector<uint32_t> > &result) const
+{
+  // a match may start at this node (root state) or continue the ones of the parent
+  std::vector<uint32_t> states;
+  auto advance = [&](uint32_t from)
+  {
+    const State& state = _states[from];
+    auto it = state.next.find( node->value() );
+    if( it != state.next.end() )
+    {
+      states.push_back( it->second );
+    }
+    if( state.wildcard >= 0 )
+    {
+      states.push_back( state.wildcard );
+    }
+  };
+
+  advance( 0 );
+  for (uint32_t state: parent_states)
+  {
+    advance( state );
+  }
+
+  for (uint32_t state: states)
+  {
+    for (uint32_t pattern: _states[state].patterns)
+    {
+      result[pattern].push_back( node->index() );
+    }
+  }
+
+  for (const auto& child: node->children())
+  {
+    visit( &child, states, result );
+  }
+}
+
 }